@@ -0,0 +1,66 @@
+#ifndef CAN_BUS_H
+#define CAN_BUS_H
+
+#include <Arduino.h>
+#include <driver/can.h>
+
+// Received frame, stamped when the RX task took it from the driver
+struct Can_frame {
+    int64_t timestamp_us;
+    can_message_t msg;
+};
+
+struct Can_bus_stats {
+    uint32_t frames;            // Frames received from the driver
+    uint32_t driver_missed;     // Frames lost because the driver RX queue was full
+    uint32_t ring_drops;        // Frames lost because the frame ring was full
+    uint32_t ring_peak;         // Highest number of frames waiting in the ring
+    uint32_t bus_errors;
+    uint32_t error_passive;     // Times the controller became error passive
+    uint32_t bus_off;           // Times the controller went bus-off (and was recovered)
+    uint32_t monitor_drops;     // Frames not copied to the monitor queue because it was full
+};
+
+// Install the driver and start the RX task. The acceptance filter only lets the decoded IDs through.
+void can_bus_start();
+
+// Features that need more IDs than the decoded ones
+enum Can_filter_user {
+    can_filter_slcan,
+    can_filter_capture,
+
+    can_filter_user_count
+};
+
+// The acceptance filter only lets the decoded IDs through, which the firmware always needs. While at least one
+// user asks for more, all IDs are accepted (users that want fewer filter in software). The RX task reinstalls the
+// driver when this changes.
+void can_bus_accept_all(Can_filter_user user, bool accept_all);
+
+// Reinstall the driver in listen-only mode (frames are neither acknowledged nor sent, commands and LBC polling fail)
+// or back in normal mode
+void can_bus_set_listen_only(bool listen_only);
+
+// can_transmit() for the other tasks: refused (ESP_ERR_INVALID_STATE) while can_rx_task reinstalls the driver
+esp_err_t can_bus_transmit(const can_message_t *message, TickType_t ticks_to_wait);
+
+// Copy every received frame to this queue of Can_frame as well (NULL: stop), e.g. for SLCAN.
+// Frames that do not fit are dropped, the frame ring is not affected.
+void can_bus_set_monitor(QueueHandle_t queue);
+
+// Take the next received frame from the ring. Returns false on timeout.
+bool can_bus_receive(Can_frame *frame, TickType_t ticks_to_wait);
+
+// Called by leafcan_task with the time spent on each received frame (decoding, LBC, capture), if defined.
+// The replay bench of the native build defines it, the firmware does not time the frames otherwise.
+void can_frame_processed(uint32_t processing_us) __attribute__((weak));
+
+void can_bus_stats(Can_bus_stats *stats);
+
+// Print the counters on the serial port
+void can_bus_print_stats();
+
+// Write the counters and the number of frames received for each decoded ID as JSON, returns the number of characters written
+int can_bus_format_stats(char *buf, size_t len);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef CAN_CAPTURE_H
+#define CAN_CAPTURE_H
+
+#include <Arduino.h>
+#include <FS.h>
+
+#include "can_bus.h"
+
+/*
+Raw CAN capture to the SD-card (.ccap files, tools/ccap2candump.py converts them to text).
+The file is a sequence of blocks, all little endian: a 32-byte header followed by count 16-byte records.
+The CRC-32 (IEEE) covers the header, with the crc field set to 0, and the records.
+*/
+
+#define CCAP_MAGIC 0x50414343   // "CCAP"
+#define CCAP_VERSION 1
+#define CCAP_BLOCK_SIZE 4096
+
+struct Ccap_block_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;         // Number of records
+    uint32_t seq;           // Block number since the start of the capture
+    uint32_t crc;
+    int64_t base_us;        // esp_timer time of the first record
+    uint32_t lost;          // Frames lost (no free block) since the previous block
+    uint32_t reserved;
+};
+
+struct Ccap_record {
+    uint32_t time_dlc;      // Bits 0-27: time since base_us (us), bits 28-31: DLC
+    uint32_t id_flags;      // Bits 0-28: ID, bit 29: extended ID, bit 30: RTR
+    uint8_t data[8];
+};
+
+#define CCAP_RECORDS_PER_BLOCK ( ( CCAP_BLOCK_SIZE - sizeof(Ccap_block_header) ) / sizeof(Ccap_record) )
+
+// Capture control and frames, from leafcan_task
+void can_capture_start();
+void can_capture_stop();
+bool can_capture_active();
+void can_capture_frame(const Can_frame &frame);
+
+// Hand the current block to the writer once it is CAN_CAPTURE_FLUSH_MS old
+void can_capture_tick();
+
+// Blocks waiting to be written
+bool can_capture_pending();
+
+// Write the blocks filled so far to the file, waiting up to ticks_to_wait for the first one (from logger_task).
+// Returns the number of blocks written.
+int can_capture_write(File &file, TickType_t ticks_to_wait);
+
+// The capture file is open (logger_task). A new capture only starts once the previous file is closed.
+void can_capture_set_writing(bool open);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef CAN_FILTER_H
+#define CAN_FILTER_H
+
+#include <Arduino.h>
+#include <driver/can.h>
+
+// Tightest acceptance filter (single or dual) that lets all the given standard IDs through.
+// Other IDs may pass too, *n_accepted is set to the number of 11-bit IDs the filter accepts.
+can_filter_config_t can_filter_for_ids(const uint32_t *ids, int n_ids, uint32_t *n_accepted);
+
+// Whether the controller would accept the frame with this filter (standard frames, extended frames are accepted)
+bool can_filter_accepts(const can_filter_config_t &filter, const can_message_t &frame);
+
+#endif
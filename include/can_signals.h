@@ -0,0 +1,93 @@
+#ifndef CAN_SIGNALS_H
+#define CAN_SIGNALS_H
+
+#include <Arduino.h>
+#include <driver/can.h>
+#include <float.h>
+
+#include "globals.h"
+
+// Frames used outside of the signal table
+#define CAN_ID_MOTOR_SPEED 0x1DA
+#define CAN_ID_BATTERY_POWER 0x1DB
+#define CAN_ID_VCM_COMMAND 0x56E
+#define CAN_ID_WAKE 0x68C
+#define CAN_ID_LBC_REQUEST 0x79B
+#define CAN_ID_LBC_RESPONSE 0x7BB
+
+// Extract a big-endian (Motorola) bit field from the frame data and return it as a float.
+// start_bit counts from the MSB of data[0] (bit 0) to the LSB of data[7] (bit 63).
+template <unsigned start_bit, unsigned length, bool is_signed>
+float extract_signal(const uint8_t *data) {
+    static_assert(length > 0 && length <= 32, "Signals are 1 to 32 bits long");
+    static_assert(start_bit + length <= 64, "Signals must fit in 8 bytes");
+
+    const unsigned first_byte = start_bit / 8;
+    const unsigned last_byte = ( start_bit + length - 1 ) / 8;
+    const uint64_t mask = ( 1ULL << length ) - 1;
+
+    uint64_t raw = 0;
+    for ( unsigned i = first_byte; i <= last_byte; i++ ) {
+        raw = ( raw << 8 ) | data[i];
+    }
+    raw = ( raw >> ( 7 - ( start_bit + length - 1 ) % 8 ) ) & mask;
+
+    // Two's complement
+    if ( is_signed && ( raw >> ( length - 1 ) ) ) {
+        return (float)(int64_t)( raw | ~mask );
+    }
+    return (float)raw;
+}
+
+// Raw value of an enumerated signal and the status it stands for
+struct Status_map {
+    uint32_t raw;
+    Message_status status;
+};
+
+// When a decoded value is published
+struct Emit_policy {
+    uint8_t average;            // Number of samples averaged into one value (1: no averaging)
+    float deadband;             // Publish only if the value moved by more than this (negative: always)
+    uint16_t min_interval_ms;   // Never publish more often than this
+    uint16_t max_interval_ms;   // Publish anyway after this time without change (0: never)
+};
+
+#define EMIT_ALWAYS { 1, -1, 0, 0 }
+#define EMIT_ON_CHANGE(max_interval_ms) { 1, 0, 0, max_interval_ms }
+#define EMIT_DEADBAND(deadband, min_interval_ms, max_interval_ms) { 1, deadband, min_interval_ms, max_interval_ms }
+#define EMIT_AVERAGE(n_samples, deadband, max_interval_ms) { n_samples, deadband, 0, max_interval_ms }
+
+struct Can_signal {
+    uint32_t id;
+    uint8_t min_dlc;                        // Frames shorter than this are ignored
+    Message_name target;
+    float (*extract)(const uint8_t *data);
+    float scale;
+    float offset;
+    float max_valid;                        // Values above are discarded
+    const Status_map *status_map;           // For enumerated signals, NULL otherwise
+    uint8_t status_map_len;
+    Emit_policy policy;
+};
+
+#define CAN_SIGNAL(id, start_bit, length, is_signed, scale, offset, target, policy) \
+    { id, ( start_bit + length + 7 ) / 8, target, extract_signal<start_bit, length, is_signed>, scale, offset, FLT_MAX, NULL, 0, policy }
+
+#define CAN_STATUS_SIGNAL(id, start_bit, length, map, target, policy) \
+    { id, ( start_bit + length + 7 ) / 8, target, extract_signal<start_bit, length, false>, 1, 0, FLT_MAX, map, sizeof(map) / sizeof(map[0]), policy }
+
+// Decode a received frame and publish the values of its signals according to their emit policy
+// (unless CAN_EMIT_POLICIES is false), stamped with timestamp_us. Returns the number of values published.
+int can_decode(const can_message_t &frame, int64_t timestamp_us);
+
+// Time of the last frame received with this ID (0 if never)
+int64_t can_last_seen_us(uint32_t id);
+
+// Number of frames decoded with this ID
+uint32_t can_frame_count(uint32_t id);
+
+// Sorted list of the IDs in the signal table, returns the number of IDs
+int can_decoded_ids(uint32_t *ids, int max_ids);
+
+#endif
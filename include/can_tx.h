@@ -0,0 +1,38 @@
+#ifndef CAN_TX_H
+#define CAN_TX_H
+
+#include <Arduino.h>
+#include <driver/can.h>
+
+#include "globals.h"
+
+// A frame sent repeatedly, optionally after waking the bus up.
+// With a confirmation, the repetitions stop as soon as the expected status is decoded from the bus.
+struct Can_tx_job {
+    Message_name request;               // Request the job belongs to (one job per request at a time)
+    Message_status request_status;
+    uint16_t command_id;                // Copied to the command_event
+    int64_t requested_us;               // Receipt of the request, the command_event times count from it
+    can_message_t frame;
+    uint8_t repeats;
+    uint16_t interval_ms;
+    bool wake;                          // Send the wake frame first
+    Message_name confirm_name;          // Status that confirms the command (invalid: none)
+    Message_status confirm_status;
+    uint16_t timeout_ms;                // Time allowed for the confirmation, from the first frame
+};
+
+// Queue a job. A job already running for the same request is cancelled and replaced.
+// A command_event message is published when the job ends (sent, confirmed, timed out, cancelled or failed).
+bool can_tx_submit(const Can_tx_job &job);
+
+// Cancel the job running for a request, if any
+bool can_tx_cancel(Message_name request);
+
+// Called by the decoder with every status decoded from the bus, confirms the jobs waiting for it
+void can_tx_status(Message_name name, Message_status status, int64_t timestamp_us);
+
+// Runs the repetition schedules of the jobs, without blocking the tasks that submit them
+void can_tx_task( void *parameter );
+
+#endif
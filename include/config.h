@@ -4,12 +4,142 @@
 #define SERIAL_BAUDRATE 460800
 #define ENABLE_SERIAL_DEBUG true
 
+// Messages are copied directly into the subscriber queues by send_msg().
+// Set to true to route them through q_out and msg_forwarder_task instead (debugging).
+#define MSG_FORWARDER_TASK false
+
+// Message queues: length, overflow policy (drop_newest, drop_oldest or block) and block timeout in ms
+#define MSG_QUEUE_LENGTH 50
+#define Q_OUT_POLICY Overflow_policy::block, 5
+#define Q_LEAFCAN_POLICY Overflow_policy::block, 10
+#define Q_DISPLAY_POLICY Overflow_policy::drop_oldest, 0
+#define Q_LOGGER_POLICY Overflow_policy::drop_oldest, 0
+#define Q_COMM_GNSS_POLICY Overflow_policy::drop_oldest, 0
+
+// Queue statistics on the serial port and on MQTT (0 to disable)
+#define DIAG_PRINT_INTERVAL_S 60
+#define DIAG_PUBLISH_INTERVAL_S 600
+
+// Largest MQTT packet (topic + payload)
+#define MQTT_BUFFER_SIZE 1024
+
+// Values are published on their own schedule (src/mqtt_schedule.cpp). Changes of event values (charger, AC, energy steps)
+// are published at once, but not more often than this in case they flap.
+#define MQTT_EVENT_MIN_INTERVAL_MS 2000
+
+// Publish the values due in one JSON object on MQTT_PREFIX "telemetry" instead of one topic per value
+#define MQTT_PACKED_PAYLOAD false
+
+// Modem and broker connection: step timeouts, polling of the waiting steps, backoff between retries (doubled on each
+// consecutive failure) and modem reset every MODEM_RESET_AFTER_FAILURES failures
+#define MODEM_AT_TIMEOUT_MS 15000
+#define MODEM_NETWORK_TIMEOUT_MS 60000
+#define MODEM_POLL_INTERVAL_MS 1000
+// The AT commands of the GPRS bring-up are sent, then their response is polled for MODEM_RESPONSE_POLL_MS per pass
+// of the task. The broker connection (TLS) times out after MODEM_CONNECT_TIMEOUT_S.
+#define MODEM_RESPONSE_POLL_MS 10
+#define MODEM_CONNECT_TIMEOUT_S 20
+#define MODEM_BACKOFF_MIN_MS 5000
+#define MODEM_BACKOFF_MAX_MS 300000
+#define MODEM_RESET_AFTER_FAILURES 3
+
+// GNSS reports pushed by the modem every GNSS_URC_FIXES fixes (1 fix/s), enabled again when none came for the timeout
+#define GNSS_URC_FIXES 1
+#define GNSS_URC_TIMEOUT_MS 5000
+
+// GNSS time is in the reports, sent this long after the second they are for.
+// The clock is set from GNSS time every CLOCK_GNSS_SYNC_INTERVAL_S, from network time only without GNSS time
+// (every CLOCK_NETWORK_SYNC_INTERVAL_S, retried every CLOCK_NETWORK_RETRY_S). The esp_timer drift is estimated
+// from GNSS syncs at least CLOCK_DRIFT_MIN_INTERVAL_S apart, larger values are treated as outliers.
+#define GNSS_URC_LATENCY_MS 100
+#define CLOCK_GNSS_SYNC_INTERVAL_S 600
+#define CLOCK_NETWORK_SYNC_INTERVAL_S 3600
+#define CLOCK_NETWORK_RETRY_S 10
+#define CLOCK_DRIFT_MIN_INTERVAL_S 300
+#define CLOCK_DRIFT_MAX_PPM 200
+#define CLOCK_DRIFT_SMOOTHING 0.5
+
+// Store-and-forward while MQTT is offline: records (512 bytes each) queued in RAM, spilled to a ring file on the SD-card
+// once BACKLOG_SPILL_THRESHOLD are waiting. Sent back at most BACKLOG_DRAIN_PER_CYCLE every BACKLOG_DRAIN_INTERVAL_MS,
+// after the live values, read from the SD-card BACKLOG_DRAIN_BATCH at a time.
+#define BACKLOG_RAM_SLOTS 16
+#define BACKLOG_SPILL_THRESHOLD 8
+#define BACKLOG_SD_SLOTS 2048
+#define BACKLOG_DRAIN_BATCH 8
+#define BACKLOG_DRAIN_PER_CYCLE 4
+#define BACKLOG_DRAIN_INTERVAL_MS 1000
+
+// MQTT commands (include/mqtt_commands.h): up to MQTT_COMMAND_PENDING wait for the outcome of their CAN job,
+// up to MQTT_COMMAND_OUTBOX responses wait to be published
+#define MQTT_COMMAND_PENDING 4
+#define MQTT_COMMAND_OUTBOX 8
+
+// GNSS track while driving (include/track.h): fixes within TRACK_MAX_ERROR_M of the simplified track are dropped,
+// a point is kept at least every TRACK_MAX_INTERVAL_S or when TRACK_WINDOW fixes are waiting. Segments of up to
+// TRACK_SEGMENT_SIZE bytes of points, TRACK_SEGMENT_QUEUE of them kept for the SD-card.
+#define TRACK_MAX_ERROR_M 10
+#define TRACK_MAX_INTERVAL_S 60
+#define TRACK_WINDOW 64
+#define TRACK_SEGMENT_SIZE 240
+#define TRACK_SEGMENT_QUEUE 4
+
+// Only receive the decoded CAN IDs (all IDs are received while SLCAN output is enabled)
+#define CAN_HW_FILTER true
+
+// Received frames are taken from the driver queue by a dedicated task and put in a larger ring
+#define CAN_DRIVER_RX_QUEUE_LENGTH 32
+#define CAN_RX_RING_LENGTH 256
+#define CAN_RX_TASK_PRIORITY 10
+// Frames decoded per leafcan_task loop
+#define CAN_RX_BATCH 32
+
+// SLCAN: frames waiting to be sent, and output buffer written to the serial port once per batch of frames
+#define SLCAN_QUEUE_LENGTH 256
+#define SLCAN_BUFFER_SIZE 1024
+
+// Battery controller (LBC) polling over ISO-TP, while the bus is awake
+#define LBC_POLLING true
+#define LBC_CELLS_INTERVAL_S 10
+#define LBC_TEMPERATURES_INTERVAL_S 30
+// All the cell voltages are published on MQTT_PREFIX "cells" at most this often (the min/max on their own topics)
+#define LBC_CELLS_PUBLISH_INTERVAL_S 60
+#define ISOTP_TIMEOUT_MS 1000
+#define ISOTP_STMIN_MS 0
+
+// Raw CAN capture to the SD-card (start_capture/stop_capture commands), in 4kB blocks written by logger_task
+#define CAN_CAPTURE_AT_BOOT false
+#define CAN_CAPTURE_BLOCKS 8
+#define CAN_CAPTURE_FLUSH_MS 1000
+// Capture all the IDs, not only the decoded ones
+#define CAN_CAPTURE_ALL_IDS true
+
+// Commands are sent by can_tx_task: wake frame, then the command frame repeated.
+// AC and charge commands stop repeating once the car reports the new status, and fail after the timeout.
+#define CAN_TX_TASK_PRIORITY 6
+#define CAN_TX_MAX_JOBS 4
+#define CAN_TX_REPEATS 30
+#define CAN_TX_CONFIRM_TIMEOUT_MS 5000
+#define CAN_TX_INTERVAL_MS 5
+#define CAN_TX_WAKE_DELAY_MS 5
+
+// Publish decoded CAN values according to their emit policy (averaging, deadband, rate limits, see can_signals.cpp).
+// false: publish every decoded value.
+#define CAN_EMIT_POLICIES true
+// Car on/off status is published when it changes, and at least this often
+#define CAR_STATUS_INTERVAL_MS 10000
+
 #define KWH_PER_GID 0.08
 #define MOTOR_RPM_TO_KMH 0.01212
 
-// Smoothing factors for power and speed reported by the car (exponential moving average)
+// Smoothing factors for power and speed reported by the car (exponential moving average).
+// They apply to samples SMOOTHING_PERIOD_US apart and are scaled to the real interval between samples.
+#define SMOOTHING_PERIOD_US 10000
 #define DISPLAY_SMOOTHING 0.9
 #define LOG_SMOOTHING 0.95
 #define MQTT_SMOOTHING 0.99
 
+// The logged energy holds the last power value for at most this long (power is published at least every 1000ms
+// while the car talks), longer gaps count as zero power
+#define LOG_ENERGY_MAX_GAP_MS 1500
+
 #endif
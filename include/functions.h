@@ -9,10 +9,34 @@ int twosComplementToInt(uint32_t twosComplement, uint32_t nBits);
 
 void exp_smooth(float *out, float in, float smoothing );
 
+// Exponential smoothing of a sample taken dt_us after the previous one (smoothing is given for SMOOTHING_PERIOD_US)
+void exp_smooth(float *out, float in, float smoothing, int64_t dt_us);
+
+// Messages are timestamped with the given sample time, or with the current time if timestamp_us is 0
 void send_msg(Message msg_out);
-void send_msg(Message_name msg_name, float val);
-void send_msg(Message_name msg_name, int val);
-void send_msg(Message_name msg_name, Message_status val);
+void send_msg(Message_name msg_name, float val, int64_t timestamp_us = 0);
+void send_msg(Message_name msg_name, int val, int64_t timestamp_us = 0);
+void send_msg(Message_name msg_name, Message_status val, int64_t timestamp_us = 0);
+void send_msg(Message_name msg_name, const Gnss_fix &val, int64_t timestamp_us = 0);
+void send_msg(Message_name msg_name, const Command_request &val, int64_t timestamp_us = 0);
+void send_msg(Message_name msg_name, const Command_event &val, int64_t timestamp_us = 0);
+void send_msg(Message_name msg_name, const Cell_summary &val, int64_t timestamp_us = 0);
 void send_msg(Message_name msg_name);
 
+// Diagnostics on the USB serial port, dropped while the port carries SLCAN
+void debug_printf(const char *format, ...) __attribute__ ((format (printf, 1, 2)));
+
+// Same for libraries printing to a Stream (TinyGSM debug output)
+class Debug_stream : public Stream {
+public:
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    void flush() override { Serial.flush(); }
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buf, size_t size) override;
+};
+
+extern Debug_stream debug_serial;
+
 #endif
\ No newline at end of file
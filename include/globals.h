@@ -1,50 +1,83 @@
 #ifndef GLOBALS_H
 #define GLOBALS_H
 
-enum Message_name {
-    invalid,
-
-    ac_status,
-    charger_status,
-    car_status,
-    logger_status,
-
-    charger_max_amps,
-
-    network_status,
-    network_latitude,
-    network_longitude,
-
-    gsm_day,
-    gsm_month,
-    gsm_year,
-    gsm_hours,
-    gsm_minutes,
-    gsm_seconds,
-
-    gnss_latitude,
-    gnss_longitude,
-    gnss_altitude,
-    gnss_speed,
-
-    battery_power_kw,
-    battery_energy_kwh,
-    speed_kmh,
+// Tasks that receive messages, one bit each in the subscriber masks below.
+// sink_state is not a task: it is the latest-value store (telemetry.h).
+enum Message_sink {
+    sink_display,
+    sink_leafcan,
+    sink_logger,
+    sink_comm_gnss,
+    sink_state,
+
+    sink_count,
+};
 
-    ac_request,
-    charge_request,
-    update_request,
-    doors_request,
+#define TO_DISPLAY   ( 1 << Message_sink::sink_display )
+#define TO_LEAFCAN   ( 1 << Message_sink::sink_leafcan )
+#define TO_LOGGER    ( 1 << Message_sink::sink_logger )
+#define TO_COMM_GNSS ( 1 << Message_sink::sink_comm_gnss )
+#define TO_STATE     ( 1 << Message_sink::sink_state )
+
+// All messages and the sinks subscribed to them by default.
+// Values that consumers only need the latest copy of go to the state store, events and
+// streams that are smoothed by their consumers go to queues.
+// Additional subscriptions can be made at startup with msg_subscribe() (see msg_bus.h).
+#define MESSAGE_TABLE(X) \
+    X( invalid,             0 ) \
+    \
+    X( ac_status,           TO_STATE ) \
+    X( charger_status,      TO_DISPLAY | TO_STATE ) \
+    X( car_status,          TO_STATE ) \
+    X( logger_status,       TO_DISPLAY ) \
+    \
+    X( charger_max_amps,    TO_STATE ) \
+    \
+    X( network_status,      TO_DISPLAY | TO_STATE ) \
+    X( network_latitude,    TO_STATE ) \
+    X( network_longitude,   TO_STATE ) \
+    \
+    X( gnss_fix,            TO_STATE ) \
+    \
+    X( battery_power_kw,    TO_DISPLAY | TO_LOGGER | TO_COMM_GNSS | TO_STATE ) \
+    X( battery_energy_kwh,  TO_DISPLAY | TO_STATE ) \
+    X( speed_kmh,           TO_DISPLAY | TO_LOGGER | TO_STATE ) \
+    \
+    X( cell_voltages,       TO_STATE ) \
+    X( battery_temperature, TO_STATE ) \
+    \
+    X( ac_request,          TO_LEAFCAN ) \
+    X( charge_request,      TO_LEAFCAN ) \
+    X( update_request,      TO_COMM_GNSS ) \
+    X( doors_request,       TO_LEAFCAN ) \
+    \
+    X( power_save_mode,     TO_DISPLAY | TO_STATE ) \
+    \
+    X( pressure,            TO_STATE ) \
+    X( pcb_temperature,     TO_STATE ) \
+    X( pressure_altitude,   TO_STATE ) \
+    \
+    X( toggle_slcan,        TO_LEAFCAN ) \
+    X( capture_request,     TO_LEAFCAN ) \
+    \
+    X( command_event,       TO_COMM_GNSS ) \
+
+#define MESSAGE_TABLE_NAME(name, sinks) name,
+#define MESSAGE_TABLE_SINKS(name, sinks) (uint8_t)(sinks),
 
-    power_save_mode,
+enum Message_name {
+    MESSAGE_TABLE(MESSAGE_TABLE_NAME)
 
-    pressure,
-    pcb_temperature,
-    pressure_altitude,
+    message_name_count,
+};
 
-    toggle_slcan,
+// Default subscriber bitmask of each message, indexed by Message_name
+constexpr uint8_t message_subscribers[] = {
+    MESSAGE_TABLE(MESSAGE_TABLE_SINKS)
 };
 
+static_assert(Message_sink::sink_count <= 8, "Subscriber masks are 8 bits wide");
+
 enum Message_status {
     invalid_status = 0,
 
@@ -67,6 +100,9 @@ enum Message_status {
     request_doors_lock,
     request_doors_unlock,
 
+    request_capture_start,
+    request_capture_stop,
+
     network_not_connected,
     network_connected,
     network_connected_mqtt,
@@ -74,15 +110,70 @@ enum Message_status {
     logger_write_started,
     logger_write_ended,
 
+    command_sent,
+    command_confirmed,
+    command_timeout,
+    command_cancelled,
+    command_failed,
+
     no_status,
 };
 
+// Compound values, carried whole in a single message so that consumers never see half of an update
+struct Gnss_fix {
+    float latitude;
+    float longitude;
+    float altitude;
+    float speed;
+};
+
+struct Date_time {
+    uint8_t year;   // Two digits
+    uint8_t month;
+    uint8_t day;
+    uint8_t hours;
+    uint8_t minutes;
+    uint8_t seconds;
+};
+
+// Summary of the cell voltages polled from the battery controller, all cells are in the lbc.h snapshot
+struct Cell_summary {
+    uint16_t min_mv;
+    uint16_t max_mv;
+    uint16_t avg_mv;
+    uint8_t min_cell;   // Index of the lowest cell
+    uint8_t max_cell;
+};
+
+// Command received over MQTT (ac_request, charge_request...), timestamped with its receipt
+struct Command_request {
+    enum Message_status status;         // e.g. request_ac_start
+    uint16_t command_id;                // Matches the Command_event to the request (0: none)
+};
+
+// Outcome of a command sent on the CAN bus. Times are counted from the receipt of the request.
+struct Command_event {
+    enum Message_name request;          // e.g. ac_request
+    enum Message_status request_status; // e.g. request_ac_start
+    enum Message_status result;         // command_sent (no confirmation expected), command_confirmed, command_timeout,
+                                        // command_cancelled or command_failed
+    uint8_t frames_sent;
+    uint16_t command_id;
+    uint32_t sent_after_us;             // First frame transmitted (0: none)
+    uint32_t confirmed_after_us;        // Confirmation decoded from the bus (command_confirmed only)
+};
+
 struct Message {
     enum Message_name name;
+    int64_t timestamp_us;   // esp_timer_get_time() when the value was sampled
     union {
         float value_float;
         int value_int;
         enum Message_status value_status;
+        struct Gnss_fix value_gnss_fix;
+        struct Command_request value_command_request;
+        struct Command_event value_command_event;
+        struct Cell_summary value_cell_summary;
     };
 };
 
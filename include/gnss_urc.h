@@ -0,0 +1,73 @@
+#ifndef GNSS_URC_H
+#define GNSS_URC_H
+
+#include <Arduino.h>
+#include "globals.h"
+
+/*
+GNSS reports pushed by the SIM7000 (AT+CGNSURC=n: one "+UGNSINF: ..." line every n fixes).
+The modem UART is read through this stream: report lines are parsed as their bytes arrive and removed,
+everything else is passed on to TinyGSM. No allocation, parsing is done field by field in fixed buffers.
+*/
+
+#define GNSS_URC_PREFIX "+UGNSINF:"
+#define GNSS_URC_PASS_BUFFER 256
+#define GNSS_URC_FIELD_SIZE 24
+
+struct Gnss_report {
+    int64_t timestamp_us;   // esp_timer time of the first byte of the report
+    bool fix;
+    Gnss_fix position;      // Only valid with a fix
+    Date_time utc;          // GNSS time, valid when utc_valid
+    bool utc_valid;
+};
+
+class Gnss_urc_stream : public Stream {
+public:
+    Gnss_urc_stream(Stream &io) : io(io) {}
+
+    // Stream seen by TinyGSM
+    int available() override;
+    int read() override;
+    int peek() override;
+    void flush() override { io.flush(); }
+    size_t write(uint8_t c) override { return io.write(c); }
+    size_t write(const uint8_t *buf, size_t size) override { return io.write(buf, size); }
+    using Stream::write;
+
+    // Parse the bytes received so far, from the owner task when TinyGSM is not reading
+    void poll();
+
+    // Latest report, true once per new report
+    bool read_report(Gnss_report *report);
+
+    uint32_t reports() const { return report_count; }
+    int64_t last_report_us() const { return latest.timestamp_us; }
+
+private:
+    void process(char c);
+    void pass(char c);
+    void end_field();
+
+    Stream &io;
+
+    // Bytes for TinyGSM
+    uint8_t pass_buffer[GNSS_URC_PASS_BUFFER];
+    uint16_t pass_head = 0;
+    uint16_t pass_count = 0;
+
+    bool line_start = true;
+    uint8_t matched = 0;        // Characters of GNSS_URC_PREFIX matched at the start of the line
+    bool in_report = false;
+
+    char field[GNSS_URC_FIELD_SIZE];
+    uint8_t field_len = 0;
+    uint8_t field_index = 0;
+
+    Gnss_report pending = {};
+    Gnss_report latest = {};
+    bool fresh = false;
+    uint32_t report_count = 0;
+};
+
+#endif
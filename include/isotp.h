@@ -0,0 +1,42 @@
+#ifndef ISOTP_H
+#define ISOTP_H
+
+#include <Arduino.h>
+#include <driver/can.h>
+
+// ISO-TP (ISO 15765-2) client channel on 11-bit IDs: single frame requests, responses of up to ISOTP_MAX_LEN
+// bytes reassembled in place. Non-blocking: fed with the received frames and ticked by its owner task.
+
+#define ISOTP_MAX_LEN 512
+
+enum Isotp_state {
+    isotp_idle,
+    isotp_waiting,      // Request sent, waiting for the first (or single) frame of the response
+    isotp_receiving,    // Waiting for consecutive frames
+    isotp_done,         // Response complete in buffer[0..len)
+    isotp_error,        // Timeout, sequence error or response too long
+};
+
+struct Isotp_channel {
+    uint32_t tx_id;
+    uint32_t rx_id;
+    Isotp_state state;
+    uint8_t buffer[ISOTP_MAX_LEN];
+    uint16_t len;           // Length announced by the first frame
+    uint16_t received;
+    uint8_t next_sn;        // Sequence number of the next consecutive frame
+    int64_t deadline_us;
+};
+
+void isotp_init(Isotp_channel *ch, uint32_t tx_id, uint32_t rx_id);
+
+// Send a request of up to 7 bytes as a single frame. Returns false if the frame could not be queued.
+bool isotp_request(Isotp_channel *ch, const uint8_t *data, uint8_t len);
+
+// Handle a received frame (frames of other IDs are ignored). Sends the flow control frame after a first frame.
+void isotp_frame(Isotp_channel *ch, const can_message_t &frame, int64_t now_us);
+
+// Check the timeouts
+void isotp_tick(Isotp_channel *ch, int64_t now_us);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef LBC_H
+#define LBC_H
+
+#include <Arduino.h>
+#include "can_bus.h"
+
+// Battery controller (LBC) data polled over ISO-TP (0x79B/0x7BB), groups 0x02 (cell voltages) and 0x04 (temperatures)
+
+#define LBC_CELL_COUNT 96
+#define LBC_TEMPERATURE_SENSORS 4
+
+struct Battery_cells {
+    int64_t voltages_timestamp_us;      // 0 until the first response
+    uint16_t voltages_mv[LBC_CELL_COUNT];
+    int64_t temperatures_timestamp_us;
+    int8_t temperatures_c[LBC_TEMPERATURE_SENSORS];
+};
+
+// Poll scheduler, from leafcan_task: frames from the LBC, then a tick per loop
+void lbc_frame(const Can_frame &frame);
+void lbc_tick();
+
+// Copy a consistent snapshot of the latest values. Lock-free for the reader.
+void lbc_read(Battery_cells *snapshot);
+
+// All the cell voltages and temperatures (once polled) as one JSON object: {"mv":[...],"temp":[...]}
+int lbc_format_json(const Battery_cells &snapshot, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef MQTT_BACKLOG_H
+#define MQTT_BACKLOG_H
+
+#include <Arduino.h>
+#include <FS.h>
+
+/*
+Store-and-forward of MQTT publishes while the broker is unreachable.
+Records are queued in RAM by comm_gnss_task; logger_task moves them to a ring file on the SD-card
+(/backlog.bin, fixed-size slots) and reads them back in batches once the connection is restored.
+The oldest records are evicted first when the RAM ring or the file is full.
+*/
+
+#define BACKLOG_MAGIC 0x474C4B42    // "BKLG"
+#define BACKLOG_VERSION 1
+#define BACKLOG_TOPIC_SIZE 24
+#define BACKLOG_RECORD_SIZE 512
+
+struct Backlog_record {
+    int64_t timestamp_us;           // esp_timer time of the scheduled publish
+    uint32_t seq;                   // Since boot, to detect duplicates
+    uint32_t boot;                  // Boot counter of the file (0 without SD-card), timestamp_us is relative to that boot
+    char topic[BACKLOG_TOPIC_SIZE]; // After MQTT_PREFIX
+    char payload[BACKLOG_RECORD_SIZE - 16 - BACKLOG_TOPIC_SIZE];    // JSON
+};
+
+struct Backlog_file_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t slots;
+    uint32_t head;                  // Oldest record
+    uint32_t count;
+    uint32_t boots;
+};
+
+struct Backlog_stats {
+    uint32_t ram;                   // Records waiting in RAM (including the batch read back from the SD-card)
+    uint32_t sd;                    // Records waiting on the SD-card
+    uint32_t stored;
+    uint32_t spilled;               // Moved from RAM to the SD-card
+    uint32_t sent;
+    uint32_t evicted;               // Lost because the backlog was full
+};
+
+// From comm_gnss_task: queue a record while offline, and report the connection state
+void backlog_push(const char *topic, const char *payload, int64_t timestamp_us);
+void backlog_set_online(bool online);
+
+// Oldest record, without removing it. False when the backlog is empty or the next batch is being read.
+bool backlog_front(Backlog_record *record);
+// Remove the record returned by backlog_front() once it has been published
+void backlog_pop(uint32_t seq);
+
+// Boot counter of the records queued now
+uint32_t backlog_boot();
+
+// From logger_task, with the SD-card mounted (NULL: no card, the backlog is kept in RAM only):
+// spill the RAM ring while offline, read back a batch while online.
+bool backlog_sd_pending();
+void backlog_sd_sync(fs::FS *fs);
+
+void backlog_stats(Backlog_stats *stats);
+int backlog_format_stats(char *buf, size_t size);
+
+#endif
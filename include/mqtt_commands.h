@@ -0,0 +1,30 @@
+#ifndef MQTT_COMMANDS_H
+#define MQTT_COMMANDS_H
+
+#include <Arduino.h>
+#include "globals.h"
+
+/*
+Commands received on MQTT_CONTROL_TOPIC: "<command> [<id>]", the optional id (letters, digits, '-', '_', '.', ':')
+being echoed in the responses. Each command is acknowledged on MQTT_PREFIX "response":
+  {"command":"start_ac","id":"42","status":"accepted","received":...}
+and the commands sent on the CAN bus once more with their outcome and the times from the receipt to the first frame
+and to the confirmation by the car:
+  {"command":"start_ac","id":"42","status":"confirmed","frames":30,"received":...,"sent":...,"confirmed":...,
+   "transmit_ms":5.1,"confirm_ms":353.0}
+Times are UTC epoch ms (left out until the clock is set). Used from comm_gnss_task only.
+*/
+
+// Dispatch a payload received on MQTT_CONTROL_TOPIC at received_us, and queue its acknowledgement
+void command_received(const uint8_t *payload, unsigned int len, int64_t received_us);
+
+// Queue the final response of a command_event message, if it belongs to a command received over MQTT
+void command_finished(const Command_event &event);
+
+// Next response to publish on MQTT_PREFIX "response"
+bool command_next_response(char *buf, size_t size);
+
+// Command counts and latency histograms
+int command_format_stats(char *buf, size_t size);
+
+#endif
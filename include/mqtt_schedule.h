@@ -0,0 +1,43 @@
+#ifndef MQTT_SCHEDULE_H
+#define MQTT_SCHEDULE_H
+
+#include <Arduino.h>
+#include "globals.h"
+#include "telemetry.h"
+
+// Published values, each on its own schedule (see the topic table in mqtt_schedule.cpp)
+
+// When a value is published
+struct Publish_policy {
+    float deadband;             // Publish when the value moved by more than this
+    uint16_t min_interval_s;    // Not more often than this, except for events
+    uint16_t max_active_s;      // Publish anyway after this time, when the car is on or charging (0: never)
+    uint16_t max_idle_s;        // Same, otherwise
+    bool event;                 // Changes are published at once (MQTT_EVENT_MIN_INTERVAL_MS instead of min_interval_s)
+};
+
+#define PUBLISH_ON_CHANGE(deadband, min_interval_s, max_active_s, max_idle_s) { deadband, min_interval_s, max_active_s, max_idle_s, false }
+#define PUBLISH_EVENT(deadband, max_active_s, max_idle_s) { deadband, 0, max_active_s, max_idle_s, true }
+
+// Values the topics are read from
+struct Publish_inputs {
+    const Telemetry *telemetry;
+    const Gnss_fix *gnss_fix;   // NULL without a fix
+    float battery_power_kw;     // Smoothed by comm_gnss_task
+};
+
+// Topics due now, one bit per topic, with their values captured for mqtt_topic_format(). force: all available topics.
+// active: the car is on or charging.
+uint32_t mqtt_schedule_due(const Publish_inputs &inputs, bool active, bool force, int64_t now_us);
+
+// Record the captured values of these topics as published
+void mqtt_schedule_sent(uint32_t topics, int64_t now_us);
+
+int mqtt_topic_count();
+const char *mqtt_topic_name(int topic);     // After MQTT_PREFIX
+int mqtt_topic_format(int topic, char *buf, size_t size);
+
+// The captured values of these topics as one JSON object, with the UTC time if the clock is set
+int mqtt_schedule_format_packed(uint32_t topics, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef MSG_BUS_H
+#define MSG_BUS_H
+
+#include <Arduino.h>
+#include "globals.h"
+
+// What to do with a message when its queue is full
+enum Overflow_policy {
+    drop_newest,    // Discard the message being sent
+    drop_oldest,    // Discard the oldest message in the queue to make room
+    block,          // Wait up to block_ms for room, then discard the message being sent
+};
+
+#define MSG_MAX_QUEUES 8
+
+struct Queue_stats {
+    const char *name;
+    uint32_t length;
+    uint32_t sends;         // Messages successfully queued
+    uint32_t drops;         // Messages lost because the queue was full
+    uint32_t peak;          // Highest number of waiting messages
+    int64_t full_time_us;   // Total time the queue was seen full
+};
+
+// Register a queue for accounting. Returns its id, or -1 if there is no room left.
+int msg_queue_register(const char *name, QueueHandle_t queue, uint32_t length, Overflow_policy policy, uint32_t block_ms);
+
+// Send a message on a registered queue, applying its overflow policy. Returns false if a message was dropped.
+bool msg_queue_send(int queue_id, const Message &msg);
+
+// Number of registered queues and copy of their counters
+int msg_queue_count();
+void msg_queue_stats(int queue_id, Queue_stats *stats);
+
+// Print the counters of all queues on the serial port
+void msg_print_stats();
+
+// Write the counters of all queues as JSON, returns the number of characters written
+int msg_format_stats(char *buf, size_t len);
+
+// Attach a registered queue to a sink. Messages for sinks without a queue are discarded.
+void msg_register_sink(Message_sink sink, int queue_id);
+
+// Hand published messages to msg_forwarder_task through this queue instead of routing them directly
+void msg_register_forwarder(int queue_id);
+
+// Subscribe a sink to a message in addition to the defaults from MESSAGE_TABLE
+void msg_subscribe(Message_sink sink, Message_name name);
+
+// Copy a message to the queue of every sink subscribed to it
+void msg_route(const Message &msg);
+
+// Publish a message from the calling task: routed directly, or through the forwarder queue if registered
+void msg_publish(const Message &msg);
+
+// Called, if defined, when msg_publish() and msg_route() start and when they are done, with the sampling time of the
+// message. The replay bench of the native build defines them to time the publishing path.
+void msg_publish_timing(bool done, int64_t timestamp_us) __attribute__((weak));
+void msg_route_timing(bool done, int64_t timestamp_us) __attribute__((weak));
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef SLCAN_H
+#define SLCAN_H
+
+#include <Arduino.h>
+#include "can_bus.h"
+
+/*
+SLCAN (Lawicel) interface on the USB serial port, e.g. for SavvyCAN.
+Commands: O/L open (accepting all IDs, or the M/m filter; L: controller in listen-only mode, no ACK, t/T/r/R are refused), C close, S6 (500kbit/s, the only rate supported),
+t/T/r/R transmit, M/m acceptance code/mask (SJA1000 dual filter, set while closed), F status flags,
+Z0/Z1 timestamps, V/v version, N serial number.
+While open, received frames are copied by can_rx_task to the SLCAN queue (see can_bus_set_monitor). slcan_task
+encodes them in a buffer that is written to the serial port in one go per batch: a slow serial port only makes
+the SLCAN queue overflow (F status bit 0), decoding is not affected. Diagnostics (debug_printf) are not printed while open.
+*/
+
+bool slcan_is_open();
+void slcan_open();
+void slcan_close();
+
+// Executes the commands received on the serial port and streams the received frames
+void slcan_task( void *parameter );
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <Arduino.h>
+#include "globals.h"
+
+// Latest value of every message routed to sink_state (see MESSAGE_TABLE in globals.h).
+// Entries that were never written have name == Message_name::invalid.
+struct Telemetry {
+    Message values[Message_name::message_name_count];
+};
+
+// Overwrite the stored value of a message (called by the message bus)
+void telemetry_write(const Message &msg);
+
+// Copy a consistent snapshot of all values. Lock-free for the reader.
+void telemetry_read(Telemetry *snapshot);
+
+#endif
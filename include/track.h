@@ -0,0 +1,64 @@
+#ifndef TRACK_H
+#define TRACK_H
+
+#include <Arduino.h>
+#include <FS.h>
+
+#include "config.h"
+#include "globals.h"
+
+/*
+GNSS track of the trips, simplified as the fixes arrive (comm_gnss_task) and delta-encoded into segments.
+A fix is dropped while the line between the last kept point and the newest fix passes within TRACK_MAX_ERROR_M
+of it and of all the other fixes dropped since. tools/track2gpx.py decodes the segments.
+
+A segment is a header followed by the points, all little endian. Each point is three zigzag varints:
+time (100 ms units of esp_timer), latitude and longitude (1e-5 degree), the first one absolute and the others
+as differences from the previous point. Closed segments are published on MQTT (track, base64 in JSON) and
+appended to /track.bin on the SD-card by logger_task.
+*/
+
+#define TRACK_MAGIC 0x4B415254      // "TRAK"
+#define TRACK_VERSION 1
+
+struct Track_segment_header {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t points;
+    uint16_t length;                // Bytes of encoded points after the header
+    uint32_t seq;                   // Segment number since boot
+    uint32_t boot;                  // Boot counter of the MQTT backlog file (0 without SD-card)
+    int64_t epoch_offset_ms;        // UTC epoch ms = esp_timer ms + offset, 0 if the clock was not set
+};
+
+struct Track_segment {
+    Track_segment_header header;
+    uint8_t data[TRACK_SEGMENT_SIZE];
+};
+
+struct Track_stats {
+    uint32_t fixes;
+    uint32_t points;                // Kept
+    uint32_t segments;
+    uint32_t bytes;                 // Of the closed segments, headers included
+    uint32_t sd_written;            // Segments
+    uint32_t sd_dropped;            // Overwritten before logger_task wrote them
+};
+
+// From comm_gnss_task: fixes while driving, end of the trip (keeps the last fix and closes the segment)
+void track_add(const Gnss_fix &fix, int64_t timestamp_us);
+void track_end();
+
+// Next closed segment to publish, from comm_gnss_task
+bool track_upload_next(Track_segment *segment);
+// {"seq":...,"boot":...,"points":...,"data":"<base64 of the header and points>"}
+int track_format_json(const Track_segment &segment, char *buf, size_t size);
+
+// From logger_task, with the SD-card mounted: append the closed segments to /track.bin
+bool track_sd_pending();
+void track_sd_write(fs::FS &fs);
+
+void track_stats(Track_stats *stats);
+int track_format_stats(char *buf, size_t size);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef WALL_CLOCK_H
+#define WALL_CLOCK_H
+
+#include <Arduino.h>
+#include "globals.h"
+
+// UTC time kept with esp_timer between occasional syncs from GNSS or network time (comm_gnss_task).
+// The drift of the esp_timer is estimated from consecutive GNSS syncs and corrected.
+
+enum Clock_source {
+    clock_unsynced,
+    clock_network,      // AT+CCLK, one second resolution
+    clock_gnss,
+};
+
+struct Clock_stats {
+    Clock_source source;        // Of the last sync
+    uint32_t syncs;
+    int64_t last_sync_us;       // esp_timer time of the last sync
+    int64_t last_error_us;      // Time set by the last sync minus the time kept until then
+    float drift_ppm;            // Estimated esp_timer drift, corrected by clock_epoch_us()
+};
+
+// Set the time: epoch_us (UTC) was the time at esp_timer time measured_at_us
+void clock_sync(int64_t epoch_us, int64_t measured_at_us, Clock_source source);
+
+// True if a sync from this source would be used now (GNSS every CLOCK_GNSS_SYNC_INTERVAL_S,
+// network time only when there was no sync at all for CLOCK_NETWORK_SYNC_INTERVAL_S)
+bool clock_sync_due(Clock_source source);
+
+bool clock_valid();
+
+// Epoch microseconds (UTC) now, or at an esp_timer time (message timestamps). 0 until the first sync.
+int64_t clock_now_us();
+int64_t clock_epoch_us(int64_t timer_us);
+
+// Conversions between UTC calendar time and epoch microseconds
+int64_t clock_epoch_from_utc(int year, int month, int day, int hours, int minutes, int seconds);
+void clock_date_time(int64_t epoch_us, Date_time *date_time);
+
+void clock_stats(Clock_stats *stats);
+
+#endif
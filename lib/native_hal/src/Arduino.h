@@ -0,0 +1,168 @@
+#ifndef NATIVE_ARDUINO_H
+#define NATIVE_ARDUINO_H
+
+// Subset of the ESP32 Arduino core used by the firmware, for running it on a Linux host
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
+
+#include "native_rtos.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define LOW 0x0
+#define HIGH 0x1
+#define INPUT 0x01
+#define OUTPUT 0x02
+
+#define SERIAL_8N1 0x800001c
+
+typedef enum {
+    GPIO_NUM_NC = -1,
+    GPIO_NUM_0 = 0, GPIO_NUM_4 = 4, GPIO_NUM_15 = 15, GPIO_NUM_21 = 21, GPIO_NUM_22 = 22,
+    GPIO_NUM_25 = 25, GPIO_NUM_33 = 33, GPIO_NUM_34 = 34, GPIO_NUM_39 = 39,
+} gpio_num_t;
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+// Arduino String, backed by std::string
+class String {
+public:
+    String(const char *str = "") : s(str ? str : "") {}
+    String(const std::string &str) : s(str) {}
+    String(char c) : s(1, c) {}
+    String(int value, unsigned char base = 10);
+    String(unsigned int value, unsigned char base = 10);
+    String(long value, unsigned char base = 10);
+    String(unsigned long value, unsigned char base = 10);
+    String(float value, unsigned int decimal_places = 2);
+    String(double value, unsigned int decimal_places = 2);
+
+    const char *c_str() const { return s.c_str(); }
+    unsigned int length() const { return s.length(); }
+    char operator[](unsigned int index) const { return s[index]; }
+
+    String substring(unsigned int from) const;
+    String substring(unsigned int from, unsigned int to) const;
+    int indexOf(char c, unsigned int from = 0) const;
+    int indexOf(const char *str, unsigned int from = 0) const;
+    bool startsWith(const String &prefix) const { return s.compare(0, prefix.s.size(), prefix.s) == 0; }
+    void trim();
+
+    long toInt() const { return atol(s.c_str()); }
+    float toFloat() const { return atof(s.c_str()); }
+
+    String &operator+=(const String &other) { s += other.s; return *this; }
+    String &operator+=(const char *other) { s += other; return *this; }
+    String &operator+=(char c) { s += c; return *this; }
+    friend String operator+(const String &a, const String &b) { return String(a.s + b.s); }
+    bool operator==(const String &other) const { return s == other.s; }
+    bool operator==(const char *other) const { return s == other; }
+    bool operator!=(const String &other) const { return s != other.s; }
+
+private:
+    std::string s;
+};
+
+// Byte stream with Arduino Print helpers
+class Stream {
+public:
+    virtual ~Stream() {}
+
+    virtual int available() { return 0; }
+    virtual int read() { return -1; }
+    virtual int peek() { return -1; }
+    virtual void flush() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buf, size_t size);
+
+    size_t write(const char *str) { return write((const uint8_t *)str, strlen(str)); }
+    size_t print(const char *str) { return write(str); }
+    size_t print(const String &str) { return write(str.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int value) { return print(String(value)); }
+    size_t print(unsigned int value) { return print(String(value)); }
+    size_t print(long value) { return print(String(value)); }
+    size_t print(unsigned long value) { return print(String(value)); }
+    size_t print(double value, int digits = 2) { return print(String(value, digits)); }
+    size_t println() { return write("\r\n"); }
+    template <typename T> size_t println(const T &value) { return print(value) + println(); }
+    size_t printf(const char *format, ...) __attribute__ ((format (printf, 2, 3)));
+
+    size_t readBytes(uint8_t *buf, size_t length);
+    String readStringUntil(char terminator);
+    void setTimeout(unsigned long timeout_ms) { timeout = timeout_ms; }
+
+protected:
+    unsigned long timeout = 1000;
+};
+
+// Serial port: Serial is the console (stdout/stdin), other ports discard what is written and receive what
+// simulated devices pass to native_serial_receive()
+class HardwareSerial : public Stream {
+public:
+    HardwareSerial(int uart_nr) : uart_nr(uart_nr) {}
+
+    void begin(unsigned long baud, uint32_t config = SERIAL_8N1, int8_t rx_pin = -1, int8_t tx_pin = -1) {}
+    void end() {}
+    void setDebugOutput(bool enable) {}
+
+    int available() override;
+    int read() override;
+    int peek() override;
+    void flush() override;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buf, size_t size) override;
+    using Stream::write;
+
+    operator bool() const { return true; }
+
+private:
+    int uart_nr;
+    int peeked = -1;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+extern HardwareSerial Serial2;
+
+void native_serial_receive(HardwareSerial &port, const char *data);
+
+// Network client interface used by PubSubClient
+class Client : public Stream {
+public:
+    virtual int connect(const char *host, uint16_t port) = 0;
+    virtual uint8_t connected() = 0;
+    virtual void stop() = 0;
+    size_t write(uint8_t c) override { return 1; }
+    using Stream::write;
+};
+
+class EspClass {
+public:
+    void restart();
+    uint32_t getFreeHeap() { return 0; }
+};
+
+extern EspClass ESP;
+
+// Implemented by the firmware
+void setup();
+void loop();
+
+#endif
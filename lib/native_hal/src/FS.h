@@ -0,0 +1,74 @@
+#ifndef NATIVE_FS_H
+#define NATIVE_FS_H
+
+// Files on the host file system
+
+#include "Arduino.h"
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+enum SeekMode {
+    SeekSet = 0,
+    SeekCur = 1,
+    SeekEnd = 2,
+};
+
+class File : public Stream {
+public:
+    File(FILE *fp = NULL) : fp(fp) {}
+
+    int available() override;
+    int read() override;
+    int peek() override;
+    void flush() override;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buf, size_t size) override;
+    using Stream::write;
+
+    size_t read(uint8_t *buf, size_t size);
+    bool seek(uint32_t pos, SeekMode mode = SeekSet);
+    size_t position() const;
+    size_t size() const;
+    void close();
+
+    operator bool() const { return fp != NULL; }
+
+private:
+    FILE *fp;
+};
+
+namespace fs {
+
+// Maps paths of the firmware into a directory of the host
+class FS {
+public:
+    FS(const char *root_env, const char *default_root) : root_env(root_env), default_root(default_root) {}
+
+    File open(const char *path, const char *mode = FILE_READ);
+    bool exists(const char *path);
+    bool remove(const char *path);
+    bool rename(const char *from, const char *to);
+    bool mkdir(const char *path);
+
+protected:
+    std::string host_path(const char *path);
+
+    const char *root_env;
+    const char *default_root;
+};
+
+}
+
+using fs::FS;
+
+class SPIFFSFS : public fs::FS {
+public:
+    SPIFFSFS() : FS("NATIVE_SPIFFS_DIR", "spiffs") {}
+    bool begin(bool format_on_fail = false) { return true; }
+};
+
+extern SPIFFSFS SPIFFS;
+
+#endif
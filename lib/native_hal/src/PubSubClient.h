@@ -0,0 +1,63 @@
+#ifndef NATIVE_PUB_SUB_CLIENT_H
+#define NATIVE_PUB_SUB_CLIENT_H
+
+/*
+Local MQTT stand-in with the PubSubClient API:
+- published messages are written as "topic payload" lines to NATIVE_MQTT_OUT (default: stdout, prefixed with "MQTT> ")
+- "topic payload" lines read from NATIVE_MQTT_IN (a file or FIFO) are delivered to subscribed topics
+- NATIVE_MQTT_PUBLISH_MS simulates the modem round trip of each publish
+- NATIVE_MQTT_OUTAGE="start_s,duration_s" makes the broker unreachable during that window
+*/
+
+#include <functional>
+#include <vector>
+
+#include "Arduino.h"
+
+#define MQTT_MAX_PACKET_SIZE 256
+
+#define MQTT_CONNECTED 0
+#define MQTT_DISCONNECTED -1
+
+class PubSubClient {
+public:
+    typedef std::function<void(char *, uint8_t *, unsigned int)> Callback;
+
+    PubSubClient(Client &client) : client(client) {}
+
+    PubSubClient &setServer(const char *domain, uint16_t port) { return *this; }
+    PubSubClient &setCallback(Callback callback) { this->callback = callback; return *this; }
+    bool setBufferSize(uint16_t size) { buffer_size = size; return true; }
+    uint16_t getBufferSize() { return buffer_size; }
+
+    bool connect(const char *id, const char *user = NULL, const char *pass = NULL, const char *will_topic = NULL,
+        uint8_t will_qos = 0, bool will_retain = false, const char *will_message = NULL, bool clean_session = true);
+    void disconnect();
+    bool connected();
+    int state() { return connected() ? MQTT_CONNECTED : MQTT_DISCONNECTED; }
+
+    bool publish(const char *topic, const char *payload, bool retained = false);
+    bool publish(const char *topic, const uint8_t *payload, unsigned int length, bool retained = false);
+    bool subscribe(const char *topic, uint8_t qos = 0);
+    bool loop();
+
+private:
+    Client &client;
+    Callback callback;
+    uint16_t buffer_size = MQTT_MAX_PACKET_SIZE;
+    bool is_connected = false;
+    std::vector<std::string> subscriptions;
+    std::string rx_line;
+    int rx_fd = -1;
+};
+
+// Publish counters of the stand-in broker
+struct Native_mqtt_counters {
+    uint32_t publishes;
+    uint32_t payload_bytes;
+    uint32_t packet_bytes;      // MQTT PUBLISH packets (fixed header, topic and payload)
+    int64_t publish_time_us;    // Time spent in publish()
+};
+void native_mqtt_counters(Native_mqtt_counters *counters);
+
+#endif
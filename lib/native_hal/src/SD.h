@@ -0,0 +1,19 @@
+#ifndef NATIVE_SD_H
+#define NATIVE_SD_H
+
+// SD card backed by a directory of the host (NATIVE_SD_DIR, default ./sdcard)
+
+#include "FS.h"
+
+class SDFS : public fs::FS {
+public:
+    SDFS() : FS("NATIVE_SD_DIR", "sdcard") {}
+
+    bool begin(uint8_t ss_pin = 5);
+    void end() {}
+    uint64_t cardSize() { return 0; }
+};
+
+extern SDFS SD;
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef NATIVE_STREAM_DEBUGGER_H
+#define NATIVE_STREAM_DEBUGGER_H
+
+#include "Arduino.h"
+
+// Pass-through stream (the host version does not echo the traffic)
+class StreamDebugger : public Stream {
+public:
+    StreamDebugger(Stream &data, Stream &dump) : data(data), dump(dump) {}
+
+    int available() override { return data.available(); }
+    int read() override { return data.read(); }
+    int peek() override { return data.peek(); }
+    size_t write(uint8_t c) override { return data.write(c); }
+    using Stream::write;
+
+private:
+    Stream &data;
+    Stream &dump;
+};
+
+#endif
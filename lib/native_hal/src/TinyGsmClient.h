@@ -0,0 +1,83 @@
+#ifndef NATIVE_TINY_GSM_CLIENT_H
+#define NATIVE_TINY_GSM_CLIENT_H
+
+// Simulated SIM7000: registered NATIVE_MODEM_REGISTER_MS after init (default at once), GNSS fixes follow a slow
+// circular track, time is the host's UTC
+
+#include "Arduino.h"
+
+typedef const char *GsmConstStr;
+
+enum TinyGSMDateTimeFormat {
+    DATE_FULL = 0,
+    DATE_TIME = 1,
+    DATE_DATE = 2,
+};
+
+class TinyGsm {
+public:
+    TinyGsm(Stream &stream) : stream(stream) {}
+
+    bool init(const char *pin = NULL);
+    bool restart(const char *pin = NULL) { gprs_connected = false; return true; }
+    bool testAT(uint32_t timeout_ms = 10000) { return true; }
+    bool setNetworkMode(uint8_t mode) { return true; }
+    bool setPreferredMode(uint8_t mode) { return true; }
+    bool waitForNetwork(uint32_t timeout_ms = 60000L, bool check_signal = false) { return true; }
+    bool isNetworkConnected();
+    int16_t getSignalQuality() { return 20; }
+
+    bool gprsConnect(const char *apn, const char *user = NULL, const char *pwd = NULL) { gprs_connected = true; return true; }
+    bool gprsDisconnect() { gprs_connected = false; return true; }
+    bool isGprsConnected() { return gprs_connected; }
+
+    bool enableGPS() { return true; }
+    bool disableGPS() { return true; }
+    bool getGPS(float *lat, float *lon, float *speed = NULL, float *alt = NULL, int *vsat = NULL, int *usat = NULL,
+        float *accuracy = NULL, int *year = NULL, int *month = NULL, int *day = NULL, int *hour = NULL,
+        int *minute = NULL, int *second = NULL);
+
+    String getGSMDateTime(TinyGSMDateTimeFormat format);
+    bool getNetworkTime(int *year, int *month, int *day, int *hour, int *minute, int *second, float *timezone);
+
+    // Raw AT commands are answered with OK (or the expected response). AT+CGNSURC=n starts the GNSS reports on Serial1,
+    // AT+CFUN=1,1 stops them. AT+CIICR brings GPRS up once registered, AT+CIPSHUT down.
+    template <typename... Args> void sendAT(Args... cmd) {
+        std::string at;
+        int unused[] = { 0, ( at_append(at, cmd), 0 )... };
+        (void)unused;
+        at_command(at.c_str());
+    }
+    int8_t waitResponse(uint32_t timeout_ms = 1000) { return 1; }
+    int8_t waitResponse(uint32_t timeout_ms, GsmConstStr r1, GsmConstStr r2 = "ERROR") { return 1; }
+
+    void maintain() {}
+
+    Stream &stream;
+
+private:
+    static void at_append(std::string &at, const char *part) { at += part; }
+    static void at_append(std::string &at, int part) { at += std::to_string(part); }
+    void at_command(const char *cmd);
+
+    bool gprs_connected = false;
+    int64_t registered_at_us = 0;
+};
+
+class TinyGsmClientSecure : public Client {
+public:
+    TinyGsmClientSecure(TinyGsm &modem, uint8_t mux = 0) : modem(modem) {}
+
+    int connect(const char *host, uint16_t port) override { return connect(host, port, 75); }
+    int connect(const char *host, uint16_t port, int timeout_s) { is_connected = modem.isGprsConnected(); return is_connected; }
+    uint8_t connected() override { return is_connected && modem.isGprsConnected(); }
+    void stop() override { is_connected = false; }
+
+private:
+    TinyGsm &modem;
+    bool is_connected = false;
+};
+
+typedef TinyGsmClientSecure TinyGsmClient;
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef NATIVE_WIRE_H
+#define NATIVE_WIRE_H
+
+// I2C bus with a simulated SPL06-007 pressure sensor at address 0x77
+
+#include "Arduino.h"
+
+class TwoWire {
+public:
+    bool begin(int sda = -1, int scl = -1, uint32_t frequency = 0) { return true; }
+
+    void beginTransmission(uint8_t address);
+    size_t write(uint8_t data);
+    uint8_t endTransmission(bool send_stop = true);
+    uint8_t requestFrom(int address, int quantity);
+    int available();
+    int read();
+
+private:
+    uint8_t address = 0;
+    uint8_t tx_buf[32];
+    size_t tx_len = 0;
+    uint8_t rx_buf[32];
+    size_t rx_len = 0;
+    size_t rx_pos = 0;
+};
+
+extern TwoWire Wire;
+
+#endif
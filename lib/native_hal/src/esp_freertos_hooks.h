@@ -0,0 +1,13 @@
+#ifndef NATIVE_ESP_FREERTOS_HOOKS_H
+#define NATIVE_ESP_FREERTOS_HOOKS_H
+
+#include "esp_err.h"
+
+typedef bool (*esp_freertos_idle_cb_t)();
+
+// There is no idle task on the host, the hook is never called
+inline esp_err_t esp_register_freertos_idle_hook(esp_freertos_idle_cb_t hook) {
+    return ESP_OK;
+}
+
+#endif
@@ -0,0 +1,294 @@
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#include "Arduino.h"
+#include "native_can.h"
+
+HardwareSerial Serial(0);
+HardwareSerial Serial1(1);
+HardwareSerial Serial2(2);
+EspClass ESP;
+
+static timespec start_time = []() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts;
+}();
+
+// NATIVE_TIMER_DRIFT_PPM makes the timer run fast (or slow, negative), like an off-frequency crystal
+static double timer_rate = []() {
+    const char *ppm = getenv("NATIVE_TIMER_DRIFT_PPM");
+    return 1 + ( ppm ? atof(ppm) : 0 ) / 1e6;
+}();
+
+int64_t esp_timer_get_time() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    int64_t elapsed_us = (int64_t)( ts.tv_sec - start_time.tv_sec ) * 1000000 + ( ts.tv_nsec - start_time.tv_nsec ) / 1000;
+    return timer_rate == 1 ? elapsed_us : (int64_t)( elapsed_us * timer_rate );
+}
+
+unsigned long millis() {
+    return esp_timer_get_time() / 1000;
+}
+
+unsigned long micros() {
+    return esp_timer_get_time();
+}
+
+void delay(uint32_t ms) {
+    usleep(ms * 1000);
+}
+
+void yield() {
+    usleep(0);
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+void digitalWrite(uint8_t pin, uint8_t val) {}
+int digitalRead(uint8_t pin) { return LOW; }
+
+void EspClass::restart() {
+    fprintf(stderr, "ESP.restart() called, exiting\n");
+    exit(1);
+}
+
+
+// String
+
+static std::string format(const char *fmt, ...) {
+    char buf[64];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+
+    return buf;
+}
+
+static std::string to_base(unsigned long value, unsigned char base, bool negative) {
+    if ( base == 10 ) {
+        return format(negative ? "-%lu" : "%lu", value);
+    }
+
+    std::string digits;
+    do {
+        digits.insert(digits.begin(), "0123456789abcdefghijklmnopqrstuvwxyz"[value % base]);
+        value /= base;
+    } while ( value );
+
+    return digits;
+}
+
+String::String(int value, unsigned char base) : String((long)value, base) {}
+String::String(unsigned int value, unsigned char base) : String((unsigned long)value, base) {}
+String::String(long value, unsigned char base) : s(value < 0 && base == 10 ? to_base(-value, base, true) : to_base(value, base, false)) {}
+String::String(unsigned long value, unsigned char base) : s(to_base(value, base, false)) {}
+String::String(float value, unsigned int decimal_places) : s(format("%.*f", decimal_places, value)) {}
+String::String(double value, unsigned int decimal_places) : s(format("%.*f", decimal_places, value)) {}
+
+String String::substring(unsigned int from) const {
+    return from < s.size() ? String(s.substr(from)) : String();
+}
+
+String String::substring(unsigned int from, unsigned int to) const {
+    if ( from > to ) {
+        std::swap(from, to);
+    }
+    return from < s.size() ? String(s.substr(from, to - from)) : String();
+}
+
+int String::indexOf(char c, unsigned int from) const {
+    size_t pos = s.find(c, from);
+    return pos == std::string::npos ? -1 : pos;
+}
+
+int String::indexOf(const char *str, unsigned int from) const {
+    size_t pos = s.find(str, from);
+    return pos == std::string::npos ? -1 : pos;
+}
+
+void String::trim() {
+    size_t first = s.find_first_not_of(" \t\r\n");
+    size_t last = s.find_last_not_of(" \t\r\n");
+    s = first == std::string::npos ? "" : s.substr(first, last - first + 1);
+}
+
+
+// Stream
+
+size_t Stream::write(const uint8_t *buf, size_t size) {
+    size_t n = 0;
+    while ( n < size && write(buf[n]) ) {
+        n++;
+    }
+    return n;
+}
+
+size_t Stream::printf(const char *fmt, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+
+    if ( len < 0 ) {
+        return 0;
+    }
+    if ( len >= (int)sizeof(buf) ) {
+        // Long output: format again into a large enough buffer
+        std::string big(len + 1, '\0');
+        va_start(args, fmt);
+        vsnprintf(&big[0], big.size(), fmt, args);
+        va_end(args);
+        return write((const uint8_t *)big.data(), len);
+    }
+
+    return write((const uint8_t *)buf, len);
+}
+
+size_t Stream::readBytes(uint8_t *buf, size_t length) {
+    size_t n = 0;
+    unsigned long start = millis();
+
+    while ( n < length && millis() - start < timeout ) {
+        int c = read();
+        if ( c < 0 ) {
+            delay(1);
+            continue;
+        }
+        buf[n++] = c;
+    }
+
+    return n;
+}
+
+String Stream::readStringUntil(char terminator) {
+    String str;
+    unsigned long start = millis();
+
+    while ( millis() - start < timeout ) {
+        int c = read();
+        if ( c < 0 ) {
+            delay(1);
+            continue;
+        }
+        if ( c == terminator ) {
+            break;
+        }
+        str += (char)c;
+    }
+
+    return str;
+}
+
+
+// Serial: the console maps to stdin/stdout. Bytes received by the other ports, from the simulated devices.
+
+static pthread_mutex_t rx_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::string rx_data[3];
+
+void native_serial_receive(HardwareSerial &port, const char *data) {
+    int uart_nr = &port == &Serial1 ? 1 : &port == &Serial2 ? 2 : 0;
+
+    pthread_mutex_lock(&rx_lock);
+    rx_data[uart_nr] += data;
+    pthread_mutex_unlock(&rx_lock);
+}
+
+int HardwareSerial::available() {
+    if ( uart_nr != 0 ) {
+        pthread_mutex_lock(&rx_lock);
+        int n = rx_data[uart_nr].size();
+        pthread_mutex_unlock(&rx_lock);
+        return n;
+    }
+    if ( peeked >= 0 ) {
+        return 1;
+    }
+
+    pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+    return poll(&pfd, 1, 0) > 0 && ( pfd.revents & POLLIN ) ? 1 : 0;
+}
+
+int HardwareSerial::read() {
+    if ( uart_nr != 0 ) {
+        pthread_mutex_lock(&rx_lock);
+        int c = -1;
+        if ( !rx_data[uart_nr].empty() ) {
+            c = (uint8_t)rx_data[uart_nr][0];
+            rx_data[uart_nr].erase(0, 1);
+        }
+        pthread_mutex_unlock(&rx_lock);
+        return c;
+    }
+    if ( peeked >= 0 ) {
+        int c = peeked;
+        peeked = -1;
+        return c;
+    }
+    if ( !available() ) {
+        return -1;
+    }
+
+    uint8_t c;
+    return ::read(STDIN_FILENO, &c, 1) == 1 ? c : -1;
+}
+
+int HardwareSerial::peek() {
+    if ( peeked < 0 ) {
+        peeked = read();
+    }
+    return peeked;
+}
+
+void HardwareSerial::flush() {
+    if ( uart_nr == 0 ) {
+        fflush(stdout);
+    }
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t *buf, size_t size) {
+    if ( uart_nr != 0 ) {
+        return size;
+    }
+    // Sent right away, like the UART
+    size_t n = fwrite(buf, 1, size, stdout);
+    fflush(stdout);
+    return n;
+}
+
+
+// Arduino entry point. NATIVE_RUN_SECONDS limits the run time (default: run forever), see native_can.h for trace replay.
+
+int main(int argc, char **argv) {
+    const char *run_seconds = getenv("NATIVE_RUN_SECONDS");
+    int64_t end_us = run_seconds ? (int64_t)( atof(run_seconds) * 1e6 ) : 0;
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    setup();
+
+    native_can_replay_start();
+    native_vcm_start();
+    native_lbc_start();
+
+    for (;;) {
+        loop();
+
+        if ( end_us > 0 && esp_timer_get_time() >= end_us ) {
+            break;
+        }
+    }
+
+    fflush(stdout);
+    exit(0);
+}
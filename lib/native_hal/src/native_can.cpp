@@ -0,0 +1,298 @@
+#include <unistd.h>
+
+#include "native_can.h"
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t alert_cond = PTHREAD_COND_INITIALIZER;
+
+static bool installed = false;
+static can_state_t state = CAN_STATE_STOPPED;
+static can_general_config_t general_config;
+static can_filter_config_t filter_config;
+static QueueHandle_t rx_queue = NULL;
+static uint32_t alerts_pending = 0;
+#define MAX_TX_HOOKS 4
+static Native_can_tx_hook tx_hooks[MAX_TX_HOOKS] = {};
+static Native_can_counters counters = {};
+
+
+// Acceptance filter of the SJA1000 style controller, standard frames only (extended frames are always accepted)
+static bool filter_accepts(const can_message_t &frame) {
+    if ( frame.flags & CAN_MSG_FLAG_EXTD ) {
+        return true;
+    }
+
+    uint32_t code = filter_config.acceptance_code;
+    uint32_t mask = filter_config.acceptance_mask;
+    uint32_t rtr = frame.flags & CAN_MSG_FLAG_RTR ? 1 : 0;
+    uint32_t data0 = frame.data_length_code > 0 ? frame.data[0] : 0;
+    uint32_t data1 = frame.data_length_code > 1 ? frame.data[1] : 0;
+
+    if ( filter_config.single_filter ) {
+        uint32_t bits = ( frame.identifier << 21 ) | ( rtr << 20 ) | ( data0 << 8 ) | data1;
+        return ( ( bits ^ code ) & ~mask & 0xFFF0FFFF ) == 0;
+    }
+
+    // Filter 1: ID, RTR and first data byte (split in two nibbles), filter 2: ID and RTR
+    uint32_t bits1 = ( frame.identifier << 21 ) | ( rtr << 20 ) | ( ( data0 >> 4 ) << 16 ) | ( data0 & 0x0F );
+    uint32_t bits2 = ( frame.identifier << 5 ) | ( rtr << 4 );
+
+    bool filter1 = ( ( bits1 ^ code ) & ~mask & 0xFFFF000F ) == 0;
+    bool filter2 = ( ( bits2 ^ code ) & ~mask & 0x0000FFF0 ) == 0;
+
+    return filter1 || filter2;
+}
+
+static void raise_alerts(uint32_t alerts) {
+    alerts_pending |= alerts & general_config.alerts_enabled;
+    if ( alerts_pending ) {
+        pthread_cond_broadcast(&alert_cond);
+    }
+}
+
+esp_err_t can_driver_install(const can_general_config_t *g_config, const can_timing_config_t *t_config, const can_filter_config_t *f_config) {
+    pthread_mutex_lock(&lock);
+
+    if ( installed ) {
+        pthread_mutex_unlock(&lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    general_config = *g_config;
+    filter_config = *f_config;
+    rx_queue = xQueueCreate(g_config->rx_queue_len, sizeof(can_message_t));
+    alerts_pending = 0;
+    state = CAN_STATE_STOPPED;
+    installed = true;
+
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+esp_err_t can_driver_uninstall() {
+    pthread_mutex_lock(&lock);
+
+    if ( !installed || state == CAN_STATE_RUNNING ) {
+        pthread_mutex_unlock(&lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    vQueueDelete(rx_queue);
+    rx_queue = NULL;
+    installed = false;
+
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+esp_err_t can_start() {
+    pthread_mutex_lock(&lock);
+
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+    if ( installed && state == CAN_STATE_STOPPED ) {
+        xQueueReset(rx_queue);
+        state = CAN_STATE_RUNNING;
+        err = ESP_OK;
+    }
+
+    pthread_mutex_unlock(&lock);
+    return err;
+}
+
+esp_err_t can_stop() {
+    pthread_mutex_lock(&lock);
+
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+    if ( installed && state == CAN_STATE_RUNNING ) {
+        state = CAN_STATE_STOPPED;
+        err = ESP_OK;
+    }
+
+    pthread_mutex_unlock(&lock);
+    return err;
+}
+
+esp_err_t can_transmit(const can_message_t *message, TickType_t ticks_to_wait) {
+    pthread_mutex_lock(&lock);
+
+    if ( !installed || state != CAN_STATE_RUNNING || general_config.mode == CAN_MODE_LISTEN_ONLY ) {
+        pthread_mutex_unlock(&lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    counters.transmitted++;
+    raise_alerts(CAN_ALERT_TX_SUCCESS | CAN_ALERT_TX_IDLE);
+    Native_can_tx_hook hooks[MAX_TX_HOOKS];
+    memcpy(hooks, tx_hooks, sizeof(hooks));
+
+    pthread_mutex_unlock(&lock);
+
+    for ( int i = 0; i < MAX_TX_HOOKS && hooks[i] != NULL; i++ ) {
+        hooks[i](*message);
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t can_receive(can_message_t *message, TickType_t ticks_to_wait) {
+    pthread_mutex_lock(&lock);
+    QueueHandle_t queue = installed ? rx_queue : NULL;
+    pthread_mutex_unlock(&lock);
+
+    if ( queue == NULL ) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if ( xQueueReceive(queue, message, ticks_to_wait) != pdTRUE ) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t can_read_alerts(uint32_t *alerts, TickType_t ticks_to_wait) {
+    pthread_mutex_lock(&lock);
+
+    if ( !installed ) {
+        pthread_mutex_unlock(&lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if ( alerts_pending == 0 && ticks_to_wait > 0 ) {
+        int64_t wait_us = ticks_to_wait == portMAX_DELAY ? 1000000000LL : (int64_t)ticks_to_wait * portTICK_PERIOD_MS * 1000;
+        timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        int64_t ns = ts.tv_nsec + wait_us * 1000;
+        ts.tv_sec += ns / 1000000000LL;
+        ts.tv_nsec = ns % 1000000000LL;
+
+        while ( alerts_pending == 0 ) {
+            if ( pthread_cond_timedwait(&alert_cond, &lock, &ts) != 0 ) {
+                break;
+            }
+        }
+    }
+
+    *alerts = alerts_pending;
+    alerts_pending = 0;
+
+    pthread_mutex_unlock(&lock);
+    return *alerts ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+esp_err_t can_reconfigure_alerts(uint32_t alerts_enabled, uint32_t *current_alerts) {
+    pthread_mutex_lock(&lock);
+
+    general_config.alerts_enabled = alerts_enabled;
+    if ( current_alerts != NULL ) {
+        *current_alerts = alerts_pending;
+    }
+    alerts_pending = 0;
+
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+esp_err_t can_initiate_recovery() {
+    pthread_mutex_lock(&lock);
+
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+    if ( installed && state == CAN_STATE_BUS_OFF ) {
+        // Recovery completes immediately on the simulated bus
+        state = CAN_STATE_STOPPED;
+        raise_alerts(CAN_ALERT_BUS_RECOVERED);
+        err = ESP_OK;
+    }
+
+    pthread_mutex_unlock(&lock);
+    return err;
+}
+
+esp_err_t can_get_status_info(can_status_info_t *status_info) {
+    pthread_mutex_lock(&lock);
+
+    if ( !installed ) {
+        pthread_mutex_unlock(&lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    *status_info = {};
+    status_info->state = state;
+    status_info->msgs_to_rx = uxQueueMessagesWaiting(rx_queue);
+    status_info->rx_missed_count = counters.missed;
+
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+esp_err_t can_clear_transmit_queue() {
+    return ESP_OK;
+}
+
+esp_err_t can_clear_receive_queue() {
+    pthread_mutex_lock(&lock);
+    if ( rx_queue != NULL ) {
+        xQueueReset(rx_queue);
+    }
+    pthread_mutex_unlock(&lock);
+
+    return ESP_OK;
+}
+
+
+bool native_can_inject(const can_message_t &frame, bool wait_for_room) {
+    pthread_mutex_lock(&lock);
+
+    while ( wait_for_room && installed && state == CAN_STATE_RUNNING && uxQueueSpacesAvailable(rx_queue) == 0 ) {
+        pthread_mutex_unlock(&lock);
+        usleep(10);
+        pthread_mutex_lock(&lock);
+    }
+
+
+    counters.offered++;
+
+    if ( !installed || state != CAN_STATE_RUNNING || !filter_accepts(frame) ) {
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+
+    counters.accepted++;
+
+    bool queued = xQueueSendToBack(rx_queue, &frame, 0) == pdTRUE;
+    if ( !queued ) {
+        counters.missed++;
+        raise_alerts(CAN_ALERT_RX_QUEUE_FULL);
+    }
+
+    pthread_mutex_unlock(&lock);
+    return queued;
+}
+
+void native_can_raise_alerts(uint32_t alerts) {
+    pthread_mutex_lock(&lock);
+
+    if ( alerts & CAN_ALERT_BUS_OFF ) {
+        state = CAN_STATE_BUS_OFF;
+    }
+    raise_alerts(alerts);
+
+    pthread_mutex_unlock(&lock);
+}
+
+void native_can_add_tx_hook(Native_can_tx_hook hook) {
+    pthread_mutex_lock(&lock);
+    for ( int i = 0; i < MAX_TX_HOOKS; i++ ) {
+        if ( tx_hooks[i] == NULL ) {
+            tx_hooks[i] = hook;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void native_can_counters(Native_can_counters *out) {
+    pthread_mutex_lock(&lock);
+    *out = counters;
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,53 @@
+#ifndef NATIVE_CAN_H
+#define NATIVE_CAN_H
+
+// Simulated CAN bus behind the driver/can.h stand-in
+
+#include "driver/can.h"
+
+// Put a frame on the bus, as if sent by another node. The acceptance filter of the driver is applied.
+// Returns false if the frame was filtered out or lost because the RX queue was full.
+// With wait_for_room, an accepted frame waits for room in the RX queue instead of being lost.
+bool native_can_inject(const can_message_t &frame, bool wait_for_room = false);
+
+// Raise driver alerts (e.g. to simulate bus errors). Only enabled alerts are reported.
+void native_can_raise_alerts(uint32_t alerts);
+
+// Called with every frame transmitted by the firmware (e.g. by a simulated ECU), up to 4 hooks
+typedef void (*Native_can_tx_hook)(const can_message_t &frame);
+void native_can_add_tx_hook(Native_can_tx_hook hook);
+
+// Frame counters of the simulated controller
+struct Native_can_counters {
+    uint32_t offered;       // Frames put on the bus
+    uint32_t accepted;      // Frames that passed the acceptance filter (one RX interrupt each)
+    uint32_t missed;        // Accepted frames lost because the RX queue was full
+    uint32_t transmitted;
+};
+void native_can_counters(Native_can_counters *counters);
+
+/*
+Trace replay, started by main() when NATIVE_CAN_TRACE is set:
+- NATIVE_CAN_TRACE: candump (-l or default output) or SLCAN text file
+- NATIVE_CAN_REPLAY_SPEED: 1 = real time (default), 10 = ten times faster,
+  0 = as fast as the firmware receives them (frames wait for room in the RX queue)
+- NATIVE_CAN_REPLAY_LOOPS: number of passes over the trace (default 1)
+- NATIVE_CAN_FRAME_US: interval between frames of traces without timestamps (default 250)
+- NATIVE_CAN_BUS_OFF_FRAME: put the controller in bus-off before this frame of the first pass
+At the end a report is printed and the program exits.
+*/
+void native_can_replay_start();
+
+/*
+Simulated VCM, started by main() when NATIVE_VCM_LATENCY_MS is set: the AC and charge commands
+sent to 0x56E take effect after this delay, and their status is broadcast on 0x54B and 0x390 at 10Hz.
+*/
+void native_vcm_start();
+
+/*
+Simulated battery controller (LBC), unless NATIVE_LBC=0: answers the ISO-TP requests
+to 0x79B for groups 0x02 (96 cell voltages) and 0x04 (temperatures) on 0x7BB.
+*/
+void native_lbc_start();
+
+#endif
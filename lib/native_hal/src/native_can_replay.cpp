@@ -0,0 +1,392 @@
+#include <time.h>
+#include <unistd.h>
+#include <deque>
+#include <vector>
+
+#include "native_can.h"
+
+// Queue and CAN statistics of the firmware (msg_bus.h, can_bus.h), printed with the report when available
+void msg_print_stats() __attribute__((weak));
+void can_bus_print_stats() __attribute__((weak));
+
+struct Trace_frame {
+    int64_t time_us;    // -1 if the trace has no timestamps
+    can_message_t frame;
+};
+
+static pthread_mutex_t samples_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<uint32_t> processing_samples;
+static bool replay_running = false;
+
+// Message bus (msg_bus.h): CPU time spent publishing, and latency from msg_publish() to the subscriber queues
+struct Publish_counters {
+    uint64_t messages;
+    uint64_t publish_ns;        // In msg_publish(), routing included unless there is a forwarder
+    uint64_t forwarded;
+    uint64_t forward_ns;        // In msg_route() called by the forwarder task
+};
+static Publish_counters publish_counters = {};
+static std::vector<uint32_t> latency_samples;
+
+// Messages handed to the forwarder: sampling time (to match them) and publish time, in queue order
+struct Forwarded_message {
+    int64_t timestamp_us;
+    int64_t published_us;
+};
+static std::deque<Forwarded_message> forwarded_messages;
+
+
+static int hex_value(char c) {
+    if ( c >= '0' && c <= '9' ) return c - '0';
+    if ( c >= 'a' && c <= 'f' ) return c - 'a' + 10;
+    if ( c >= 'A' && c <= 'F' ) return c - 'A' + 10;
+    return -1;
+}
+
+static bool parse_hex(const char *str, int digits, uint32_t *value) {
+    *value = 0;
+    for ( int i = 0; i < digits; i++ ) {
+        int v = hex_value(str[i]);
+        if ( v < 0 ) {
+            return false;
+        }
+        *value = ( *value << 4 ) | v;
+    }
+    return true;
+}
+
+// "t1DB8<data>[tttt]" / "T<8 digit id><dlc><data>[tttt]"
+static bool parse_slcan(const char *line, Trace_frame *out) {
+    bool extended = line[0] == 'T';
+    int id_digits = extended ? 8 : 3;
+    uint32_t id, dlc;
+
+    if ( !parse_hex(line + 1, id_digits, &id) || !parse_hex(line + 1 + id_digits, 1, &dlc) || dlc > 8 ) {
+        return false;
+    }
+
+    const char *data = line + 2 + id_digits;
+    for ( uint32_t i = 0; i < dlc; i++ ) {
+        uint32_t byte;
+        if ( !parse_hex(data + 2 * i, 2, &byte) ) {
+            return false;
+        }
+        out->frame.data[i] = byte;
+    }
+
+    out->frame.identifier = id;
+    out->frame.data_length_code = dlc;
+    out->frame.flags = extended ? CAN_MSG_FLAG_EXTD : CAN_MSG_FLAG_NONE;
+
+    // Optional timestamp in ms (wraps at 60000)
+    uint32_t ms;
+    out->time_us = parse_hex(data + 2 * dlc, 4, &ms) ? (int64_t)ms * 1000 : -1;
+
+    return true;
+}
+
+// "(1436509052.249713) can0 1DB#0123" or "can0  1DB   [2]  01 23"
+static bool parse_candump(const char *line, Trace_frame *out) {
+    out->time_us = -1;
+
+    if ( line[0] == '(' ) {
+        double t = atof(line + 1);
+        out->time_us = (int64_t)( t * 1e6 );
+        line = strchr(line, ')');
+        if ( line == NULL ) {
+            return false;
+        }
+        line++;
+    }
+
+    char iface[32], id_str[16], rest[128];
+    if ( sscanf(line, "%31s %15s %127[^\n]", iface, id_str, rest) < 2 ) {
+        return false;
+    }
+
+    char *hash = strchr(id_str, '#');
+    const char *data_str;
+    int dlc = -1;
+
+    if ( hash != NULL ) {
+        // Compact format, the data follows the #
+        *hash = '\0';
+        data_str = strchr(line, '#') + 1;
+    }
+    else {
+        if ( sscanf(rest, "[%d]", &dlc) != 1 ) {
+            return false;
+        }
+        data_str = strchr(rest, ']') + 1;
+    }
+
+    out->frame.identifier = strtoul(id_str, NULL, 16);
+    out->frame.flags = strlen(id_str) > 3 ? CAN_MSG_FLAG_EXTD : CAN_MSG_FLAG_NONE;
+
+    int n = 0;
+    for ( const char *c = data_str; *c && n < 8; ) {
+        if ( hex_value(c[0]) >= 0 && hex_value(c[1]) >= 0 ) {
+            out->frame.data[n++] = hex_value(c[0]) << 4 | hex_value(c[1]);
+            c += 2;
+        }
+        else if ( *c == ' ' ) {
+            c++;
+        }
+        else {
+            break;
+        }
+    }
+
+    out->frame.data_length_code = dlc >= 0 ? dlc : n;
+    return true;
+}
+
+static std::vector<Trace_frame> load_trace(const char *path) {
+    std::vector<Trace_frame> frames;
+
+    FILE *fp = fopen(path, "r");
+    if ( fp == NULL ) {
+        fprintf(stderr, "Cannot open CAN trace %s\n", path);
+        exit(1);
+    }
+
+    // Lines end with \n (candump) or \r (SLCAN)
+    std::string line;
+    int c;
+    do {
+        c = fgetc(fp);
+        if ( c != '\r' && c != '\n' && c != EOF ) {
+            line += (char)c;
+            continue;
+        }
+
+        size_t start = line.find_first_not_of(" \t");
+        if ( start != std::string::npos ) {
+            const char *l = line.c_str() + start;
+            Trace_frame f = {};
+            bool ok = ( l[0] == 't' || l[0] == 'T' ) ? parse_slcan(l, &f) : parse_candump(l, &f);
+            if ( ok ) {
+                frames.push_back(f);
+            }
+        }
+        line.clear();
+    } while ( c != EOF );
+
+    fclose(fp);
+    return frames;
+}
+
+static uint32_t percentile(std::vector<uint32_t> &sorted, double p) {
+    if ( sorted.empty() ) {
+        return 0;
+    }
+    return sorted[(size_t)( p / 100 * ( sorted.size() - 1 ) )];
+}
+
+static void *replay_thread(void *arg) {
+    const char *path = getenv("NATIVE_CAN_TRACE");
+    const char *speed_env = getenv("NATIVE_CAN_REPLAY_SPEED");
+    const char *loops_env = getenv("NATIVE_CAN_REPLAY_LOOPS");
+    const char *frame_us_env = getenv("NATIVE_CAN_FRAME_US");
+    const char *bus_off_env = getenv("NATIVE_CAN_BUS_OFF_FRAME");
+
+    double speed = speed_env ? atof(speed_env) : 1;
+    int loops = loops_env ? atoi(loops_env) : 1;
+    int64_t frame_us = frame_us_env ? atoll(frame_us_env) : 250;
+    long bus_off_frame = bus_off_env ? atol(bus_off_env) : -1;
+
+    std::vector<Trace_frame> trace = load_trace(path);
+    if ( trace.empty() ) {
+        fprintf(stderr, "No frames in CAN trace %s\n", path);
+        exit(1);
+    }
+
+    // Trace time of every frame, relative to the first one
+    std::vector<int64_t> offsets(trace.size());
+    int64_t t = 0;
+    for ( size_t i = 0; i < trace.size(); i++ ) {
+        if ( i > 0 ) {
+            int64_t dt = trace[i].time_us >= 0 && trace[i - 1].time_us >= 0 ? trace[i].time_us - trace[i - 1].time_us : frame_us;
+            // SLCAN timestamps wrap every 60 s
+            if ( dt < 0 ) {
+                dt += 60000000;
+            }
+            t += dt;
+        }
+        offsets[i] = t;
+    }
+    int64_t trace_duration = t + frame_us;
+
+    // Let the firmware install the CAN driver
+    delay(1500);
+
+    Native_can_counters before;
+    native_can_counters(&before);
+
+    int64_t start = esp_timer_get_time();
+    uint64_t lagging = 0;
+
+    for ( int loop = 0; loop < loops; loop++ ) {
+        for ( size_t i = 0; i < trace.size(); i++ ) {
+            if ( speed > 0 ) {
+                int64_t due = start + (int64_t)( ( loop * trace_duration + offsets[i] ) / speed );
+                int64_t wait = due - esp_timer_get_time();
+                if ( wait > 0 ) {
+                    usleep(wait);
+                }
+                else if ( wait < -10000 ) {
+                    lagging++;
+                }
+            }
+
+            if ( loop == 0 && (long)i == bus_off_frame ) {
+                native_can_raise_alerts(CAN_ALERT_BUS_ERROR | CAN_ALERT_ERR_PASS | CAN_ALERT_BUS_OFF);
+            }
+
+            native_can_inject(trace[i].frame, speed <= 0);
+        }
+    }
+
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    // Let the firmware drain its queues
+    delay(500);
+
+    Native_can_counters after;
+    native_can_counters(&after);
+
+    uint32_t offered = after.offered - before.offered;
+    uint32_t accepted = after.accepted - before.accepted;
+    uint32_t missed = after.missed - before.missed;
+
+    pthread_mutex_lock(&samples_lock);
+    replay_running = false;
+    std::vector<uint32_t> samples = processing_samples;
+    std::vector<uint32_t> latencies = latency_samples;
+    Publish_counters publish = publish_counters;
+    pthread_mutex_unlock(&samples_lock);
+
+    std::sort(samples.begin(), samples.end());
+    std::sort(latencies.begin(), latencies.end());
+    uint64_t publish_cpu_ns = publish.publish_ns + publish.forward_ns;
+
+    printf("\nCAN replay: %s, speed %s, %d loop(s)\n", path, speed > 0 ? String(speed, 1).c_str() : "max", loops);
+    printf("  frames offered   %u in %.3f s (%.0f frames/s), %llu sent more than 10 ms late\n",
+        offered, elapsed / 1e6, offered / ( elapsed / 1e6 ), (unsigned long long)lagging);
+    printf("  frames accepted  %u (%.1f %% of offered, one RX interrupt each)\n",
+        accepted, offered ? 100.0 * accepted / offered : 0);
+    printf("  RX queue overrun %u frames (%.2f %%)\n", missed, accepted ? 100.0 * missed / accepted : 0);
+    printf("  decode time per frame (us): p50 %u, p90 %u, p99 %u, p99.9 %u, max %u (%u samples)\n",
+        percentile(samples, 50), percentile(samples, 90), percentile(samples, 99), percentile(samples, 99.9),
+        samples.empty() ? 0 : samples.back(), (unsigned)samples.size());
+    printf("  messages published %llu (%llu through the forwarder), CPU per message %.0f ns, per accepted frame %.0f ns\n",
+        (unsigned long long)publish.messages, (unsigned long long)publish.forwarded,
+        publish.messages ? (double)publish_cpu_ns / publish.messages : 0, accepted ? (double)publish_cpu_ns / accepted : 0);
+    printf("  publish to subscriber queues (us): p50 %u, p90 %u, p99 %u, p99.9 %u, max %u\n",
+        percentile(latencies, 50), percentile(latencies, 90), percentile(latencies, 99), percentile(latencies, 99.9),
+        latencies.empty() ? 0 : latencies.back());
+
+    if ( msg_print_stats ) {
+        msg_print_stats();
+    }
+    if ( can_bus_print_stats ) {
+        can_bus_print_stats();
+    }
+
+    fflush(stdout);
+    exit(0);
+}
+
+// Decode time of each frame in leafcan_task
+void can_frame_processed(uint32_t processing_us) {
+    pthread_mutex_lock(&samples_lock);
+    if ( replay_running ) {
+        processing_samples.push_back(processing_us);
+    }
+    pthread_mutex_unlock(&samples_lock);
+}
+
+static int64_t thread_cpu_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static thread_local int64_t publish_start_ns = 0;
+static thread_local int64_t publish_start_us = 0;
+static thread_local int64_t route_start_ns = 0;
+static thread_local bool publishing = false;
+static thread_local bool routed = false;
+
+void msg_publish_timing(bool done, int64_t timestamp_us) {
+    if ( !done ) {
+        publishing = true;
+        routed = false;
+        publish_start_us = esp_timer_get_time();
+        publish_start_ns = thread_cpu_ns();
+        return;
+    }
+
+    int64_t cpu_ns = thread_cpu_ns() - publish_start_ns;
+    int64_t now_us = esp_timer_get_time();
+    publishing = false;
+
+    pthread_mutex_lock(&samples_lock);
+    if ( replay_running ) {
+        publish_counters.messages++;
+        publish_counters.publish_ns += cpu_ns;
+
+        if ( routed ) {
+            latency_samples.push_back(now_us - publish_start_us);
+        }
+        else {
+            forwarded_messages.push_back({ timestamp_us, publish_start_us });
+        }
+    }
+    pthread_mutex_unlock(&samples_lock);
+}
+
+void msg_route_timing(bool done, int64_t timestamp_us) {
+    if ( !done ) {
+        route_start_ns = thread_cpu_ns();
+        return;
+    }
+
+    // Routed by msg_publish() itself
+    if ( publishing ) {
+        routed = true;
+        return;
+    }
+
+    // Routed by the forwarder task
+    int64_t cpu_ns = thread_cpu_ns() - route_start_ns;
+    int64_t now_us = esp_timer_get_time();
+
+    pthread_mutex_lock(&samples_lock);
+    if ( replay_running ) {
+        publish_counters.forwarded++;
+        publish_counters.forward_ns += cpu_ns;
+
+        // Messages dropped by the forwarder queue are skipped
+        while ( !forwarded_messages.empty() && forwarded_messages.front().timestamp_us != timestamp_us ) {
+            forwarded_messages.pop_front();
+        }
+        if ( !forwarded_messages.empty() ) {
+            latency_samples.push_back(now_us - forwarded_messages.front().published_us);
+            forwarded_messages.pop_front();
+        }
+    }
+    pthread_mutex_unlock(&samples_lock);
+}
+
+void native_can_replay_start() {
+    if ( getenv("NATIVE_CAN_TRACE") == NULL ) {
+        return;
+    }
+
+    replay_running = true;
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, replay_thread, NULL);
+    pthread_detach(thread);
+}
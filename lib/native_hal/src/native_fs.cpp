@@ -0,0 +1,107 @@
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "FS.h"
+#include "SD.h"
+
+SDFS SD;
+SPIFFSFS SPIFFS;
+
+
+int File::available() {
+    if ( fp == NULL ) {
+        return 0;
+    }
+    return size() - position();
+}
+
+int File::read() {
+    return fp ? fgetc(fp) : -1;
+}
+
+int File::peek() {
+    if ( fp == NULL ) {
+        return -1;
+    }
+    int c = fgetc(fp);
+    if ( c != EOF ) {
+        ungetc(c, fp);
+    }
+    return c;
+}
+
+void File::flush() {
+    if ( fp ) {
+        fflush(fp);
+    }
+}
+
+size_t File::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t File::write(const uint8_t *buf, size_t size) {
+    return fp ? fwrite(buf, 1, size, fp) : 0;
+}
+
+size_t File::read(uint8_t *buf, size_t size) {
+    return fp ? fread(buf, 1, size, fp) : 0;
+}
+
+bool File::seek(uint32_t pos, SeekMode mode) {
+    return fp && fseek(fp, pos, mode == SeekSet ? SEEK_SET : mode == SeekCur ? SEEK_CUR : SEEK_END) == 0;
+}
+
+size_t File::position() const {
+    return fp ? ftell(fp) : 0;
+}
+
+size_t File::size() const {
+    if ( fp == NULL ) {
+        return 0;
+    }
+    struct stat st;
+    return fstat(fileno(fp), &st) == 0 ? st.st_size : 0;
+}
+
+void File::close() {
+    if ( fp ) {
+        fclose(fp);
+        fp = NULL;
+    }
+}
+
+
+std::string fs::FS::host_path(const char *path) {
+    const char *root = getenv(root_env);
+    return std::string(root ? root : default_root) + ( path[0] == '/' ? "" : "/" ) + path;
+}
+
+File fs::FS::open(const char *path, const char *mode) {
+    // Read-write append like the ESP32 FILE_APPEND, so that appended files can also be read back
+    const char *host_mode = strcmp(mode, FILE_APPEND) == 0 ? "a+" : strcmp(mode, FILE_WRITE) == 0 ? "w+" : mode;
+    return File(fopen(host_path(path).c_str(), host_mode));
+}
+
+bool fs::FS::exists(const char *path) {
+    return access(host_path(path).c_str(), F_OK) == 0;
+}
+
+bool fs::FS::remove(const char *path) {
+    return ::remove(host_path(path).c_str()) == 0;
+}
+
+bool fs::FS::rename(const char *from, const char *to) {
+    return ::rename(host_path(from).c_str(), host_path(to).c_str()) == 0;
+}
+
+bool fs::FS::mkdir(const char *path) {
+    return ::mkdir(host_path(path).c_str(), 0755) == 0;
+}
+
+bool SDFS::begin(uint8_t ss_pin) {
+    const char *root = getenv(root_env);
+    ::mkdir(root ? root : default_root, 0755);
+    return true;
+}
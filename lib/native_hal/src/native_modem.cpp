@@ -0,0 +1,141 @@
+#include <time.h>
+#include <unistd.h>
+
+#include "TinyGsmClient.h"
+
+bool TinyGsm::init(const char *pin) {
+    const char *register_ms = getenv("NATIVE_MODEM_REGISTER_MS");
+    registered_at_us = esp_timer_get_time() + ( register_ms ? atoi(register_ms) * 1000LL : 0 );
+    gprs_connected = false;
+    return true;
+}
+
+bool TinyGsm::isNetworkConnected() {
+    return esp_timer_get_time() >= registered_at_us;
+}
+
+// 2 km circle driven at 50 km/h
+static void track(float *lat, float *lon) {
+    const float radius_deg = 0.009;
+    float t = esp_timer_get_time() / 1e6;
+    float angle = t * 50 / 3.6 / ( radius_deg * 111320 );
+
+    *lat = 46.52 + radius_deg * sinf(angle);
+    *lon = 6.63 + radius_deg * cosf(angle) / cosf(46.52 * M_PI / 180);
+}
+
+// GNSS reports (+UGNSINF) written to Serial1 every urc_fixes fixes, one fix per second, 100 ms after the second
+static volatile int urc_fixes = 0;
+
+static void *urc_thread(void *arg) {
+    for ( int fix = 1; ; fix++ ) {
+        timespec wall;
+        clock_gettime(CLOCK_REALTIME, &wall);
+        usleep(( 1000000000L - wall.tv_nsec ) / 1000 + 100000);
+
+        if ( urc_fixes <= 0 || fix % urc_fixes != 0 ) {
+            continue;
+        }
+
+        float lat, lon;
+        track(&lat, &lon);
+
+        time_t now = time(NULL);
+        struct tm utc;
+        gmtime_r(&now, &utc);
+
+        char utc_text[24];
+        strftime(utc_text, sizeof(utc_text), "%Y%m%d%H%M%S.000", &utc);
+
+        char line[160];
+        snprintf(line, sizeof(line), "\r\n+UGNSINF: 1,1,%s,%.6f,%.6f,380.000,50.00,0.0,1,,1.2,1.5,0.9,,12,8,,,42,,\r\n", utc_text, lat, lon);
+        native_serial_receive(Serial1, line);
+    }
+
+    return NULL;
+}
+
+void TinyGsm::at_command(const char *cmd) {
+    static bool started = false;
+
+    if ( strncmp(cmd, "+CGNSURC=", 9) == 0 ) {
+        urc_fixes = atoi(cmd + 9);
+
+        if ( !started ) {
+            started = true;
+            pthread_t thread;
+            pthread_create(&thread, NULL, urc_thread, NULL);
+            pthread_detach(thread);
+        }
+    }
+    else if ( strcmp(cmd, "+CFUN=1,1") == 0 ) {
+        urc_fixes = 0;
+    }
+    else if ( strcmp(cmd, "+CIICR") == 0 ) {
+        gprs_connected = isNetworkConnected();
+    }
+    else if ( strcmp(cmd, "+CIPSHUT") == 0 ) {
+        gprs_connected = false;
+    }
+}
+
+bool TinyGsm::getGPS(float *lat, float *lon, float *speed, float *alt, int *vsat, int *usat,
+    float *accuracy, int *year, int *month, int *day, int *hour, int *minute, int *second) {
+    track(lat, lon);
+
+    if ( speed ) *speed = 50;
+    if ( alt ) *alt = 380;
+    if ( vsat ) *vsat = 12;
+    if ( usat ) *usat = 8;
+    if ( accuracy ) *accuracy = 1.2;
+
+    time_t now = time(NULL);
+    struct tm utc;
+    gmtime_r(&now, &utc);
+
+    if ( year ) *year = utc.tm_year + 1900;
+    if ( month ) *month = utc.tm_mon + 1;
+    if ( day ) *day = utc.tm_mday;
+    if ( hour ) *hour = utc.tm_hour;
+    if ( minute ) *minute = utc.tm_min;
+    if ( second ) *second = utc.tm_sec;
+
+    return true;
+}
+
+String TinyGsm::getGSMDateTime(TinyGSMDateTimeFormat format) {
+    time_t now = time(NULL);
+    struct tm utc;
+    gmtime_r(&now, &utc);
+
+    char buf[32];
+    switch ( format ) {
+        case DATE_TIME:
+            strftime(buf, sizeof(buf), "%H:%M:%S+00", &utc);
+            break;
+        case DATE_DATE:
+            strftime(buf, sizeof(buf), "%y/%m/%d", &utc);
+            break;
+        default:
+            strftime(buf, sizeof(buf), "%y/%m/%d,%H:%M:%S+00", &utc);
+            break;
+    }
+
+    return String(buf);
+}
+
+bool TinyGsm::getNetworkTime(int *year, int *month, int *day, int *hour, int *minute, int *second, float *timezone) {
+    time_t now = time(NULL);
+    struct tm utc;
+    gmtime_r(&now, &utc);
+
+    *year = utc.tm_year + 1900;
+    *month = utc.tm_mon + 1;
+    *day = utc.tm_mday;
+    *hour = utc.tm_hour;
+    *minute = utc.tm_min;
+    *second = utc.tm_sec;
+    *timezone = 0;
+
+    return true;
+}
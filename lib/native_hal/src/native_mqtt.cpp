@@ -0,0 +1,162 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "PubSubClient.h"
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static Native_mqtt_counters counters = {};
+
+
+// NATIVE_MQTT_OUTAGE="start_s,duration_s": the broker is unreachable during that window (seconds since boot)
+static bool in_outage() {
+    const char *outage = getenv("NATIVE_MQTT_OUTAGE");
+    if ( outage == NULL ) {
+        return false;
+    }
+
+    float start_s = 0, duration_s = 0;
+    sscanf(outage, "%f,%f", &start_s, &duration_s);
+
+    float now_s = millis() / 1000.0;
+    return now_s >= start_s && now_s < start_s + duration_s;
+}
+
+static bool topic_matches(const std::string &filter, const char *topic) {
+    if ( filter.size() > 0 && filter.back() == '#' ) {
+        return strncmp(filter.c_str(), topic, filter.size() - 1) == 0;
+    }
+    return filter == topic;
+}
+
+bool PubSubClient::connect(const char *id, const char *user, const char *pass, const char *will_topic,
+    uint8_t will_qos, bool will_retain, const char *will_message, bool clean_session) {
+    is_connected = !in_outage() && client.connect("localhost", 1883);
+
+    const char *in_path = getenv("NATIVE_MQTT_IN");
+    if ( is_connected && in_path != NULL && rx_fd < 0 ) {
+        rx_fd = open(in_path, O_RDONLY | O_NONBLOCK);
+    }
+
+    return is_connected;
+}
+
+void PubSubClient::disconnect() {
+    is_connected = false;
+    client.stop();
+}
+
+bool PubSubClient::connected() {
+    is_connected = is_connected && !in_outage() && client.connected();
+    return is_connected;
+}
+
+bool PubSubClient::publish(const char *topic, const char *payload, bool retained) {
+    return publish(topic, (const uint8_t *)payload, strlen(payload), retained);
+}
+
+bool PubSubClient::publish(const char *topic, const uint8_t *payload, unsigned int length, bool retained) {
+    if ( !connected() ) {
+        return false;
+    }
+
+    // Same limit as PubSubClient: the whole packet must fit in the buffer
+    unsigned int remaining = 2 + strlen(topic) + length;
+    unsigned int packet = 1 + ( remaining < 128 ? 1 : remaining < 16384 ? 2 : 3 ) + remaining;
+    if ( packet > buffer_size ) {
+        return false;
+    }
+
+    int64_t start = esp_timer_get_time();
+
+    const char *delay_ms = getenv("NATIVE_MQTT_PUBLISH_MS");
+    if ( delay_ms != NULL ) {
+        delay(atoi(delay_ms));
+    }
+
+    static FILE *out = NULL;
+    static bool out_is_stdout = false;
+    pthread_mutex_lock(&lock);
+
+    if ( out == NULL ) {
+        const char *out_path = getenv("NATIVE_MQTT_OUT");
+        out = out_path ? fopen(out_path, "a") : stdout;
+        out_is_stdout = out_path == NULL;
+    }
+
+    fprintf(out, "%s%s ", out_is_stdout ? "MQTT> " : "", topic);
+
+    // Binary payloads are written in hex
+    bool printable = true;
+    for ( unsigned int i = 0; i < length; i++ ) {
+        printable = printable && payload[i] >= 0x20 && payload[i] < 0x7F;
+    }
+    for ( unsigned int i = 0; i < length; i++ ) {
+        if ( printable ) {
+            fputc(payload[i], out);
+        }
+        else {
+            fprintf(out, "%02x", payload[i]);
+        }
+    }
+    fputc('\n', out);
+    fflush(out);
+
+    counters.publishes++;
+    counters.payload_bytes += length;
+    counters.packet_bytes += packet;
+    counters.publish_time_us += esp_timer_get_time() - start;
+
+    pthread_mutex_unlock(&lock);
+
+    return true;
+}
+
+bool PubSubClient::subscribe(const char *topic, uint8_t qos) {
+    if ( !connected() ) {
+        return false;
+    }
+    subscriptions.push_back(topic);
+    return true;
+}
+
+bool PubSubClient::loop() {
+    if ( !connected() ) {
+        return false;
+    }
+    if ( rx_fd < 0 ) {
+        return true;
+    }
+
+    char buf[256];
+    ssize_t n;
+
+    while ( ( n = ::read(rx_fd, buf, sizeof(buf)) ) > 0 ) {
+        for ( ssize_t i = 0; i < n; i++ ) {
+            if ( buf[i] != '\n' ) {
+                rx_line += buf[i];
+                continue;
+            }
+
+            // "topic payload"
+            size_t space = rx_line.find(' ');
+            std::string topic = rx_line.substr(0, space);
+            std::string payload = space == std::string::npos ? "" : rx_line.substr(space + 1);
+            rx_line.clear();
+
+            for ( size_t s = 0; s < subscriptions.size(); s++ ) {
+                if ( callback && topic_matches(subscriptions[s], topic.c_str()) ) {
+                    callback(&topic[0], (uint8_t *)&payload[0], payload.size());
+                    break;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+void native_mqtt_counters(Native_mqtt_counters *out) {
+    pthread_mutex_lock(&lock);
+    *out = counters;
+    pthread_mutex_unlock(&lock);
+}
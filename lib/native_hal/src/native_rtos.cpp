@@ -0,0 +1,230 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "native_rtos.h"
+#include "esp_timer.h"
+
+struct Native_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    uint8_t *items;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+};
+
+struct Native_task {
+    pthread_t thread;
+    TaskFunction_t function;
+    void *parameter;
+    const char *name;
+};
+
+// Absolute deadline for pthread_cond_timedwait
+static timespec deadline(TickType_t ticks) {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    uint64_t ns = (uint64_t)ticks * portTICK_PERIOD_MS * 1000000ULL + ts.tv_nsec;
+    ts.tv_sec += ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+
+    return ts;
+}
+
+// Wait on a condition until pred() is true or the timeout expires. Called with the queue locked.
+template <typename Pred>
+static bool wait_for(QueueHandle_t q, pthread_cond_t *cond, TickType_t ticks, Pred pred) {
+    if ( pred() ) {
+        return true;
+    }
+    if ( ticks == 0 ) {
+        return false;
+    }
+
+    timespec ts = deadline(ticks);
+
+    while ( !pred() ) {
+        int err = ticks == portMAX_DELAY ? pthread_cond_wait(cond, &q->lock) : pthread_cond_timedwait(cond, &q->lock, &ts);
+        if ( err == ETIMEDOUT ) {
+            return pred();
+        }
+    }
+
+    return true;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    QueueHandle_t q = (QueueHandle_t)calloc(1, sizeof(Native_queue));
+
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+    q->items = (uint8_t *)malloc(length * item_size);
+    q->length = length;
+    q->item_size = item_size;
+
+    return q;
+}
+
+static BaseType_t queue_send(QueueHandle_t q, const void *item, TickType_t ticks_to_wait, bool to_front) {
+    if ( q == NULL ) {
+        return pdFALSE;
+    }
+
+    pthread_mutex_lock(&q->lock);
+
+    if ( !wait_for(q, &q->not_full, ticks_to_wait, [q]() { return q->count < q->length; }) ) {
+        pthread_mutex_unlock(&q->lock);
+        return pdFALSE;
+    }
+
+    UBaseType_t index;
+    if ( to_front ) {
+        q->head = ( q->head + q->length - 1 ) % q->length;
+        index = q->head;
+    }
+    else {
+        index = ( q->head + q->count ) % q->length;
+    }
+
+    memcpy(q->items + index * q->item_size, item, q->item_size);
+    q->count++;
+
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+
+    return pdTRUE;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t q, const void *item, TickType_t ticks_to_wait) {
+    return queue_send(q, item, ticks_to_wait, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t q, const void *item, TickType_t ticks_to_wait) {
+    return queue_send(q, item, ticks_to_wait, true);
+}
+
+static BaseType_t queue_receive(QueueHandle_t q, void *item, TickType_t ticks_to_wait, bool remove) {
+    if ( q == NULL ) {
+        return pdFALSE;
+    }
+
+    pthread_mutex_lock(&q->lock);
+
+    if ( !wait_for(q, &q->not_empty, ticks_to_wait, [q]() { return q->count > 0; }) ) {
+        pthread_mutex_unlock(&q->lock);
+        return pdFALSE;
+    }
+
+    memcpy(item, q->items + q->head * q->item_size, q->item_size);
+
+    if ( remove ) {
+        q->head = ( q->head + 1 ) % q->length;
+        q->count--;
+        pthread_cond_signal(&q->not_full);
+    }
+
+    pthread_mutex_unlock(&q->lock);
+
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks_to_wait) {
+    return queue_receive(q, item, ticks_to_wait, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t q, void *item, TickType_t ticks_to_wait) {
+    return queue_receive(q, item, ticks_to_wait, false);
+}
+
+BaseType_t xQueueReset(QueueHandle_t q) {
+    pthread_mutex_lock(&q->lock);
+    q->head = 0;
+    q->count = 0;
+    pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q) {
+    pthread_mutex_lock(&q->lock);
+    UBaseType_t count = q->count;
+    pthread_mutex_unlock(&q->lock);
+
+    return count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t q) {
+    pthread_mutex_lock(&q->lock);
+    UBaseType_t spaces = q->length - q->count;
+    pthread_mutex_unlock(&q->lock);
+
+    return spaces;
+}
+
+void vQueueDelete(QueueHandle_t q) {
+    free(q->items);
+    free(q);
+}
+
+static void *task_entry(void *arg) {
+    Native_task *task = (Native_task *)arg;
+    task->function(task->parameter);
+
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stack_depth, void *parameter,
+    UBaseType_t priority, TaskHandle_t *handle, BaseType_t core_id) {
+    Native_task *task = new Native_task;
+    task->function = function;
+    task->parameter = parameter;
+    task->name = name;
+
+    // Priorities and core affinity are ignored on the host, the stack is left at the pthread default
+    if ( pthread_create(&task->thread, NULL, task_entry, task) != 0 ) {
+        delete task;
+        return pdFAIL;
+    }
+
+    pthread_detach(task->thread);
+
+    if ( handle != NULL ) {
+        *handle = task;
+    }
+
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack_depth, void *parameter,
+    UBaseType_t priority, TaskHandle_t *handle) {
+    return xTaskCreatePinnedToCore(function, name, stack_depth, parameter, priority, handle, 0);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    usleep(ticks * portTICK_PERIOD_MS * 1000);
+}
+
+TickType_t xTaskGetTickCount() {
+    return esp_timer_get_time() / 1000 / portTICK_PERIOD_MS;
+}
+
+void vTaskDelayUntil(TickType_t *previous_wake_time, TickType_t increment) {
+    *previous_wake_time += increment;
+
+    int32_t remaining = (int32_t)( *previous_wake_time - xTaskGetTickCount() );
+    if ( remaining > 0 ) {
+        vTaskDelay(remaining);
+    }
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    return 0;
+}
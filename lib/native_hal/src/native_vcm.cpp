@@ -0,0 +1,74 @@
+#include <unistd.h>
+
+#include "native_can.h"
+
+// Simulated VCM: applies the commands sent to 0x56E after NATIVE_VCM_LATENCY_MS and reports
+// the climate control (0x54B) and charger (0x390) status at 10Hz
+
+static volatile bool ac_on = false;
+static volatile bool charging = false;
+
+// Time each command (first data byte) takes effect, 0 if none pending
+static volatile int64_t pending_at_us[256] = {};
+static volatile int last_command = -1;
+
+static int64_t latency_us = 0;
+
+static void on_transmit(const can_message_t &frame) {
+    if ( frame.identifier != 0x56E || frame.data_length_code < 1 ) {
+        return;
+    }
+
+    // The first frame of a burst starts the action, repeats are ignored
+    if ( last_command != frame.data[0] ) {
+        last_command = frame.data[0];
+        pending_at_us[frame.data[0]] = esp_timer_get_time() + latency_us;
+    }
+}
+
+static void *vcm_thread(void *arg) {
+    for (;;) {
+        usleep(100000);
+
+        for ( int command = 0; command < 256; command++ ) {
+            if ( pending_at_us[command] == 0 || esp_timer_get_time() < pending_at_us[command] ) {
+                continue;
+            }
+
+            switch ( command ) {
+                case 0x4e: ac_on = true; break;
+                case 0x56: ac_on = false; break;
+                case 0x66: charging = true; break;
+            }
+            pending_at_us[command] = 0;
+        }
+
+        can_message_t frame = {};
+        frame.identifier = 0x54B;
+        frame.data_length_code = 8;
+        frame.data[1] = ac_on ? 0x40 : 0x00;
+        native_can_inject(frame);
+
+        frame = {};
+        frame.identifier = 0x390;
+        frame.data_length_code = 8;
+        frame.data[5] = charging ? 0x88 : 0x80;
+        native_can_inject(frame);
+    }
+
+    return NULL;
+}
+
+void native_vcm_start() {
+    const char *latency_env = getenv("NATIVE_VCM_LATENCY_MS");
+    if ( latency_env == NULL ) {
+        return;
+    }
+
+    latency_us = atoi(latency_env) * 1000LL;
+    native_can_add_tx_hook(on_transmit);
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, vcm_thread, NULL);
+    pthread_detach(thread);
+}
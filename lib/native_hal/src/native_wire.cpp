@@ -0,0 +1,110 @@
+#include "Wire.h"
+
+TwoWire Wire;
+
+/*
+Register model of the SPL06-007: the calibration coefficients give 25 degC and
+about 96000 Pa (roughly 380 m) with the measurement registers left at 0.
+*/
+
+#define SPL06_ADDRESS 0x77
+
+static uint8_t spl06_registers[0x40] = {};
+static uint8_t spl06_pointer = 0;
+
+static void spl06_reset() {
+    memset(spl06_registers, 0, sizeof(spl06_registers));
+
+    // COEF: c0 = 50, c1 = 0, c00 = 96000, all others 0
+    spl06_registers[0x10] = 50 >> 4;
+    spl06_registers[0x11] = ( 50 & 0x0F ) << 4;
+    spl06_registers[0x13] = ( 96000 >> 12 ) & 0xFF;
+    spl06_registers[0x14] = ( 96000 >> 4 ) & 0xFF;
+    spl06_registers[0x15] = ( 96000 & 0x0F ) << 4;
+
+    // MEAS_CFG: coefficients and sensor ready
+    spl06_registers[0x08] = 0xC0;
+}
+
+static uint8_t spl06_read() {
+    uint8_t val = spl06_registers[spl06_pointer & 0x3F];
+
+    // Continuous measurement: results are always ready
+    if ( spl06_pointer == 0x08 && ( val & 0x07 ) == 0x07 ) {
+        val |= 0x30;
+    }
+
+    spl06_pointer++;
+    return val;
+}
+
+void TwoWire::beginTransmission(uint8_t addr) {
+    address = addr;
+    tx_len = 0;
+}
+
+size_t TwoWire::write(uint8_t data) {
+    if ( tx_len >= sizeof(tx_buf) ) {
+        return 0;
+    }
+    tx_buf[tx_len++] = data;
+    return 1;
+}
+
+uint8_t TwoWire::endTransmission(bool send_stop) {
+    if ( address != SPL06_ADDRESS ) {
+        return 2;   // NACK on address
+    }
+
+    static bool initialized = false;
+    if ( !initialized ) {
+        spl06_reset();
+        initialized = true;
+    }
+
+    if ( tx_len > 0 ) {
+        spl06_pointer = tx_buf[0];
+    }
+
+    // Register writes
+    for ( size_t i = 1; i < tx_len; i++ ) {
+        uint8_t reg = spl06_pointer + i - 1;
+
+        if ( reg == 0x0C && ( tx_buf[i] & 0x0F ) == 0x09 ) {
+            spl06_reset();
+        }
+        else if ( reg == 0x08 ) {
+            // Only the mode bits of MEAS_CFG are writable
+            spl06_registers[0x08] = ( spl06_registers[0x08] & 0xF8 ) | ( tx_buf[i] & 0x07 );
+        }
+        else if ( reg < sizeof(spl06_registers) ) {
+            spl06_registers[reg] = tx_buf[i];
+        }
+    }
+
+    tx_len = 0;
+    return 0;
+}
+
+uint8_t TwoWire::requestFrom(int addr, int quantity) {
+    rx_len = 0;
+    rx_pos = 0;
+
+    if ( addr != SPL06_ADDRESS ) {
+        return 0;
+    }
+
+    while ( rx_len < (size_t)quantity && rx_len < sizeof(rx_buf) ) {
+        rx_buf[rx_len++] = spl06_read();
+    }
+
+    return rx_len;
+}
+
+int TwoWire::available() {
+    return rx_len - rx_pos;
+}
+
+int TwoWire::read() {
+    return rx_pos < rx_len ? rx_buf[rx_pos++] : -1;
+}
@@ -0,0 +1,292 @@
+#include <Arduino.h>
+#include <driver/can.h>
+
+#include "config.h"
+#include "functions.h"
+#include "can_bus.h"
+#include "can_signals.h"
+#include "can_filter.h"
+
+#include <esp_timer.h>
+
+#define CAN_ALERTS ( CAN_ALERT_RX_QUEUE_FULL | CAN_ALERT_BUS_ERROR | CAN_ALERT_ERR_PASS | CAN_ALERT_BUS_OFF | CAN_ALERT_BUS_RECOVERED )
+
+static QueueHandle_t frame_ring = xQueueCreate(CAN_RX_RING_LENGTH, sizeof(Can_frame));
+
+static QueueHandle_t volatile monitor_queue = NULL;
+
+static Can_bus_stats stats = {};
+static portMUX_TYPE stats_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Driver missed count at the last reinstall (the driver counts from its installation)
+static uint32_t missed_before_install = 0;
+
+// Users that need all the IDs (one bit each), and the filter applied by the RX task
+static uint32_t accept_all_users = 0;
+static bool requested_accept_all = false;
+static bool requested_listen_only = false;
+static volatile uint32_t filter_requests = 0;
+static uint32_t filter_installed = 0;
+static portMUX_TYPE filter_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Transmissions in progress from the other tasks, refused while the driver is reinstalled
+static uint32_t tx_in_progress = 0;
+static bool tx_paused = false;
+static portMUX_TYPE tx_mux = portMUX_INITIALIZER_UNLOCKED;
+
+
+// Refuse new transmissions and wait for those in progress, or allow them again
+static void pause_transmit(bool pause) {
+    portENTER_CRITICAL(&tx_mux);
+    tx_paused = pause;
+    portEXIT_CRITICAL(&tx_mux);
+
+    for (;;) {
+        portENTER_CRITICAL(&tx_mux);
+        bool idle = tx_in_progress == 0;
+        portEXIT_CRITICAL(&tx_mux);
+
+        if ( !pause || idle ) {
+            return;
+        }
+        vTaskDelay(1);
+    }
+}
+
+
+// (Re)install the CAN driver, accepting all IDs or only the decoded ones. Listen only: no ACK, no transmission.
+static void can_install(bool accept_all, bool listen_only) {
+    can_general_config_t can_general_config = {
+        .mode = listen_only ? CAN_MODE_LISTEN_ONLY : CAN_MODE_NORMAL,
+        .tx_io = (gpio_num_t) GPIO_NUM_25,
+        .rx_io = (gpio_num_t) GPIO_NUM_39,
+        .clkout_io = (gpio_num_t) CAN_IO_UNUSED,
+        .bus_off_io = (gpio_num_t) CAN_IO_UNUSED,
+        .tx_queue_len = 10,
+        .rx_queue_len = CAN_DRIVER_RX_QUEUE_LENGTH,
+        .alerts_enabled = CAN_ALERTS,
+        .clkout_divider = 0,
+    };
+
+    can_timing_config_t can_timing_config = CAN_TIMING_CONFIG_500KBITS();
+    can_filter_config_t can_filter_config = CAN_FILTER_CONFIG_ACCEPT_ALL();
+
+    if ( CAN_HW_FILTER && !accept_all ) {
+        uint32_t ids[16];
+        int n_ids = can_decoded_ids(ids, 15);
+        uint32_t n_accepted;
+
+        // Responses of the battery controller
+        if ( LBC_POLLING ) {
+            ids[n_ids++] = CAN_ID_LBC_RESPONSE;
+        }
+
+        can_filter_config = can_filter_for_ids(ids, n_ids, &n_accepted);
+
+        debug_printf("CAN filter: %s, code %08x, mask %08x, %u of 2048 IDs accepted for %d received\n",
+            can_filter_config.single_filter ? "single" : "dual",
+            can_filter_config.acceptance_code, can_filter_config.acceptance_mask, n_accepted, n_ids);
+    }
+
+    // The filter can only be changed with the driver uninstalled, which deletes its TX queue
+    pause_transmit(true);
+    can_stop();
+    can_driver_uninstall();
+
+    portENTER_CRITICAL(&stats_mux);
+    missed_before_install = stats.driver_missed;
+    portEXIT_CRITICAL(&stats_mux);
+
+    esp_err_t error;
+
+    error = can_driver_install(&can_general_config, &can_timing_config, &can_filter_config);
+
+    if ( error != ESP_OK ) {
+        debug_printf("Error with CAN driver install.\n");
+        delay(1000);
+        ESP.restart();
+    }
+
+    error = can_start();
+    if ( error != ESP_OK ) {
+        debug_printf("Error starting CAN.\n");
+        delay(1000);
+        ESP.restart();
+    }
+
+    pause_transmit(false);
+}
+
+static void handle_alerts(uint32_t alerts) {
+    if ( alerts & CAN_ALERT_RX_QUEUE_FULL ) {
+        can_status_info_t status;
+        if ( can_get_status_info(&status) == ESP_OK ) {
+            portENTER_CRITICAL(&stats_mux);
+            stats.driver_missed = missed_before_install + status.rx_missed_count;
+            portEXIT_CRITICAL(&stats_mux);
+        }
+    }
+
+    portENTER_CRITICAL(&stats_mux);
+    if ( alerts & CAN_ALERT_BUS_ERROR ) {
+        stats.bus_errors++;
+    }
+    if ( alerts & CAN_ALERT_ERR_PASS ) {
+        stats.error_passive++;
+    }
+    if ( alerts & CAN_ALERT_BUS_OFF ) {
+        stats.bus_off++;
+    }
+    portEXIT_CRITICAL(&stats_mux);
+
+    // Bus-off: wait for the recovery sequence (128 x 11 recessive bits), then restart
+    if ( alerts & CAN_ALERT_BUS_OFF ) {
+        debug_printf("CAN bus-off, recovering.\n");
+        ESP_ERROR_CHECK_WITHOUT_ABORT(can_initiate_recovery());
+    }
+    if ( alerts & CAN_ALERT_BUS_RECOVERED ) {
+        debug_printf("CAN bus recovered.\n");
+        ESP_ERROR_CHECK_WITHOUT_ABORT(can_start());
+    }
+}
+
+// Moves frames from the driver to the frame ring as soon as they arrive, and handles the driver alerts
+static void can_rx_task( void *parameter ) {
+    for (;;) {
+        Can_frame frame;
+
+        if ( can_receive(&frame.msg, pdMS_TO_TICKS(10)) == ESP_OK ) {
+            frame.timestamp_us = esp_timer_get_time();
+
+            bool queued = xQueueSendToBack(frame_ring, &frame, 0) == pdTRUE;
+            uint32_t waiting = uxQueueMessagesWaiting(frame_ring);
+
+            QueueHandle_t monitor = monitor_queue;
+            bool monitor_dropped = monitor != NULL && xQueueSendToBack(monitor, &frame, 0) != pdTRUE;
+
+            portENTER_CRITICAL(&stats_mux);
+            stats.frames++;
+            if ( !queued ) {
+                stats.ring_drops++;
+            }
+            if ( waiting > stats.ring_peak ) {
+                stats.ring_peak = waiting;
+            }
+            if ( monitor_dropped ) {
+                stats.monitor_drops++;
+            }
+            portEXIT_CRITICAL(&stats_mux);
+        }
+
+        uint32_t alerts;
+        if ( can_read_alerts(&alerts, 0) == ESP_OK ) {
+            handle_alerts(alerts);
+        }
+
+        if ( filter_requests != filter_installed ) {
+            portENTER_CRITICAL(&filter_mux);
+            bool accept_all = requested_accept_all;
+            bool listen_only = requested_listen_only;
+            filter_installed = filter_requests;
+            portEXIT_CRITICAL(&filter_mux);
+
+            can_install(accept_all, listen_only);
+        }
+    }
+}
+
+void can_bus_start() {
+    can_install(false, false);
+
+    // Above the other tasks, so that frames are taken from the driver even while they are busy
+    xTaskCreatePinnedToCore( can_rx_task, "can_rx_task", 4096, NULL, CAN_RX_TASK_PRIORITY, NULL, 1);
+}
+
+void can_bus_accept_all(Can_filter_user user, bool accept_all) {
+    portENTER_CRITICAL(&filter_mux);
+    if ( accept_all ) {
+        accept_all_users |= 1UL << user;
+    }
+    else {
+        accept_all_users &= ~( 1UL << user );
+    }
+
+    if ( requested_accept_all != ( accept_all_users != 0 ) ) {
+        requested_accept_all = accept_all_users != 0;
+        filter_requests++;
+    }
+    portEXIT_CRITICAL(&filter_mux);
+}
+
+void can_bus_set_listen_only(bool listen_only) {
+    portENTER_CRITICAL(&filter_mux);
+    if ( requested_listen_only != listen_only ) {
+        requested_listen_only = listen_only;
+        filter_requests++;
+    }
+    portEXIT_CRITICAL(&filter_mux);
+}
+
+esp_err_t can_bus_transmit(const can_message_t *message, TickType_t ticks_to_wait) {
+    portENTER_CRITICAL(&tx_mux);
+    bool paused = tx_paused;
+    if ( !paused ) {
+        tx_in_progress++;
+    }
+    portEXIT_CRITICAL(&tx_mux);
+
+    if ( paused ) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t result = can_transmit(message, ticks_to_wait);
+
+    portENTER_CRITICAL(&tx_mux);
+    tx_in_progress--;
+    portEXIT_CRITICAL(&tx_mux);
+
+    return result;
+}
+
+void can_bus_set_monitor(QueueHandle_t queue) {
+    monitor_queue = queue;
+}
+
+bool can_bus_receive(Can_frame *frame, TickType_t ticks_to_wait) {
+    return xQueueReceive(frame_ring, frame, ticks_to_wait) == pdTRUE;
+}
+
+void can_bus_stats(Can_bus_stats *out) {
+    portENTER_CRITICAL(&stats_mux);
+    *out = stats;
+    portEXIT_CRITICAL(&stats_mux);
+}
+
+void can_bus_print_stats() {
+    Can_bus_stats s;
+    can_bus_stats(&s);
+
+    debug_printf("CAN rx %u frames, lost %u (driver) %u (ring), ring peak %u/%d, bus errors %u, error passive %u, bus-off %u, monitor drops %u\n",
+        s.frames, s.driver_missed, s.ring_drops, s.ring_peak, CAN_RX_RING_LENGTH, s.bus_errors, s.error_passive, s.bus_off, s.monitor_drops);
+}
+
+int can_bus_format_stats(char *buf, size_t len) {
+    Can_bus_stats s;
+    can_bus_stats(&s);
+
+    int n = snprintf(buf, len, "{\"frames\":%u,\"driver_missed\":%u,\"ring_drops\":%u,\"ring_peak\":%u,\"bus_errors\":%u,\"err_passive\":%u,\"bus_off\":%u,\"monitor_drops\":%u,\"ids\":{",
+        s.frames, s.driver_missed, s.ring_drops, s.ring_peak, s.bus_errors, s.error_passive, s.bus_off, s.monitor_drops);
+
+    uint32_t ids[16];
+    int n_ids = can_decoded_ids(ids, 16);
+
+    for ( int i = 0; i < n_ids && n < (int)len; i++ ) {
+        n += snprintf(buf + n, len - n, "%s\"%03x\":%u", i > 0 ? "," : "", ids[i], can_frame_count(ids[i]));
+    }
+
+    if ( n < (int)len ) {
+        n += snprintf(buf + n, len - n, "}}");
+    }
+
+    return n;
+}
@@ -0,0 +1,191 @@
+#include <Arduino.h>
+#include <FS.h>
+
+#include "config.h"
+#include "can_capture.h"
+
+#include <esp_timer.h>
+
+struct Ccap_block {
+    Ccap_block_header header;
+    Ccap_record records[CCAP_RECORDS_PER_BLOCK];
+};
+
+static_assert(sizeof(Ccap_block_header) == 32, "Block header must be 32 bytes");
+static_assert(sizeof(Ccap_record) == 16, "Records must be 16 bytes");
+static_assert(sizeof(Ccap_block) <= CCAP_BLOCK_SIZE, "Block too large");
+
+static QueueHandle_t create_free_blocks() {
+    QueueHandle_t queue = xQueueCreate(CAN_CAPTURE_BLOCKS, sizeof(uint8_t));
+    for ( uint8_t i = 0; i < CAN_CAPTURE_BLOCKS; i++ ) {
+        xQueueSendToBack(queue, &i, 0);
+    }
+    return queue;
+}
+
+// Preallocated blocks, passed between leafcan_task (filling) and logger_task (writing) by index.
+// The queues are never reset: a block is in one of them, being filled or being written.
+static Ccap_block blocks[CAN_CAPTURE_BLOCKS];
+static QueueHandle_t q_free_blocks = create_free_blocks();
+static QueueHandle_t q_full_blocks = xQueueCreate(CAN_CAPTURE_BLOCKS, sizeof(uint8_t));
+
+static volatile bool active = false;
+static volatile bool writing = false;   // The capture file is open in logger_task
+
+// Block being filled (-1: none), owned by leafcan_task
+static int current = -1;
+static unsigned long current_started_ms = 0;
+static uint32_t next_seq = 0;
+static uint32_t lost = 0;
+
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len) {
+    static const uint32_t nibble_table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+    };
+
+    for ( size_t i = 0; i < len; i++ ) {
+        crc ^= data[i];
+        crc = ( crc >> 4 ) ^ nibble_table[crc & 0x0F];
+        crc = ( crc >> 4 ) ^ nibble_table[crc & 0x0F];
+    }
+
+    return crc;
+}
+
+static void submit_current() {
+    if ( current < 0 ) {
+        return;
+    }
+
+    uint8_t index = current;
+    xQueueSendToBack(q_full_blocks, &index, 0);    // Cannot fail: there are as many slots as blocks
+    current = -1;
+}
+
+void can_capture_start() {
+    // The previous capture file must be written and closed first
+    if ( active || writing ) {
+        return;
+    }
+
+    next_seq = 0;
+    lost = 0;
+
+    if ( CAN_CAPTURE_ALL_IDS ) {
+        can_bus_accept_all(can_filter_capture, true);
+    }
+
+    active = true;
+}
+
+void can_capture_stop() {
+    if ( !active ) {
+        return;
+    }
+
+    submit_current();
+    active = false;
+
+    // No file was opened for this capture: its blocks must not end up in the next capture's file
+    if ( !writing ) {
+        uint8_t index;
+        while ( xQueueReceive(q_full_blocks, &index, 0) == pdTRUE ) {
+            xQueueSendToBack(q_free_blocks, &index, 0);
+        }
+    }
+
+    if ( CAN_CAPTURE_ALL_IDS ) {
+        can_bus_accept_all(can_filter_capture, false);
+    }
+}
+
+bool can_capture_active() {
+    return active;
+}
+
+void can_capture_frame(const Can_frame &frame) {
+    if ( !active ) {
+        return;
+    }
+
+    // Record times are 28 bits wide
+    if ( current >= 0 && frame.timestamp_us - blocks[current].header.base_us >= ( 1 << 28 ) ) {
+        submit_current();
+    }
+
+    if ( current < 0 ) {
+        uint8_t index;
+        if ( xQueueReceive(q_free_blocks, &index, 0) != pdTRUE ) {
+            // The SD-card does not keep up
+            lost++;
+            return;
+        }
+
+        current = index;
+        current_started_ms = millis();
+
+        Ccap_block_header &header = blocks[current].header;
+        header.magic = CCAP_MAGIC;
+        header.version = CCAP_VERSION;
+        header.count = 0;
+        header.seq = next_seq++;
+        header.crc = 0;
+        header.base_us = frame.timestamp_us;
+        header.lost = lost;
+        header.reserved = 0;
+
+        lost = 0;
+    }
+
+    Ccap_block &block = blocks[current];
+    Ccap_record &record = block.records[block.header.count++];
+
+    const can_message_t &msg = frame.msg;
+    uint8_t dlc = msg.data_length_code > 8 ? 8 : msg.data_length_code;
+
+    record.time_dlc = (uint32_t)( frame.timestamp_us - block.header.base_us ) | ( (uint32_t)dlc << 28 );
+    record.id_flags = ( msg.identifier & 0x1FFFFFFF )
+        | ( msg.flags & CAN_MSG_FLAG_EXTD ? 1UL << 29 : 0 )
+        | ( msg.flags & CAN_MSG_FLAG_RTR ? 1UL << 30 : 0 );
+    memcpy(record.data, msg.data, 8);
+
+    if ( block.header.count == CCAP_RECORDS_PER_BLOCK ) {
+        submit_current();
+    }
+}
+
+void can_capture_tick() {
+    if ( current >= 0 && millis() - current_started_ms >= CAN_CAPTURE_FLUSH_MS ) {
+        submit_current();
+    }
+}
+
+bool can_capture_pending() {
+    return uxQueueMessagesWaiting(q_full_blocks) > 0;
+}
+
+void can_capture_set_writing(bool open) {
+    writing = open;
+}
+
+int can_capture_write(File &file, TickType_t ticks_to_wait) {
+    int written = 0;
+    uint8_t index;
+
+    while ( xQueueReceive(q_full_blocks, &index, written == 0 ? ticks_to_wait : 0) == pdTRUE ) {
+        Ccap_block &block = blocks[index];
+        size_t len = sizeof(Ccap_block_header) + block.header.count * sizeof(Ccap_record);
+
+        block.header.crc = 0;
+        block.header.crc = ~crc32_update(0xFFFFFFFF, (const uint8_t *)&block, len);
+
+        file.write((const uint8_t *)&block, len);
+        written++;
+
+        xQueueSendToBack(q_free_blocks, &index, 0);
+    }
+
+    return written;
+}
@@ -0,0 +1,102 @@
+#include <Arduino.h>
+#include <driver/can.h>
+
+#include "can_filter.h"
+
+/*
+The controller compares the incoming ID with an acceptance code, bits set in the
+mask are "don't care". With one code/mask pair covering several IDs, the mask
+is the set of bits that differ between them. The dual filter mode gives two
+pairs (ID and RTR only for standard frames), the IDs are then split in the two
+groups that let the fewest other IDs through.
+*/
+
+#define MAX_FILTER_IDS 16
+
+// Code and mask (11 bits) matching all IDs whose bit is set in group
+static void group_filter(const uint32_t *ids, int n_ids, uint32_t group, uint32_t *code, uint32_t *mask) {
+    bool first = true;
+    *code = 0;
+    *mask = 0;
+
+    for ( int i = 0; i < n_ids; i++ ) {
+        if ( !( group & ( 1 << i ) ) ) {
+            continue;
+        }
+        if ( first ) {
+            *code = ids[i] & CAN_STD_ID_MASK;
+            first = false;
+        }
+        *mask |= ( ids[i] ^ *code ) & CAN_STD_ID_MASK;
+    }
+}
+
+can_filter_config_t can_filter_for_ids(const uint32_t *ids, int n_ids, uint32_t *n_accepted) {
+    can_filter_config_t accept_all = CAN_FILTER_CONFIG_ACCEPT_ALL();
+
+    if ( n_ids <= 0 || n_ids > MAX_FILTER_IDS ) {
+        *n_accepted = CAN_STD_ID_MASK + 1;
+        return accept_all;
+    }
+
+    uint32_t all = ( 1 << n_ids ) - 1;
+
+    // Single filter: ID bits 31..21, RTR and the first two data bytes are don't care
+    uint32_t code, mask;
+    group_filter(ids, n_ids, all, &code, &mask);
+
+    can_filter_config_t best = {
+        .acceptance_code = code << 21,
+        .acceptance_mask = ( mask << 21 ) | 0x001FFFFF,
+        .single_filter = true,
+    };
+    uint32_t best_accepted = 1 << __builtin_popcount(mask);
+
+    // Dual filter: try every split in two groups (the first ID always in group 1)
+    for ( uint32_t group1 = 1; group1 < all; group1 += 2 ) {
+        uint32_t code1, mask1, code2, mask2;
+        group_filter(ids, n_ids, group1, &code1, &mask1);
+        group_filter(ids, n_ids, all & ~group1, &code2, &mask2);
+
+        // Upper bound, the two groups can overlap
+        uint32_t accepted = ( 1 << __builtin_popcount(mask1) ) + ( 1 << __builtin_popcount(mask2) );
+
+        if ( accepted < best_accepted ) {
+            best_accepted = accepted;
+
+            // Filter 1: ID bits 31..21, filter 2: ID bits 15..5. RTR and data nibbles are don't care.
+            best.acceptance_code = ( code1 << 21 ) | ( code2 << 5 );
+            best.acceptance_mask = ( mask1 << 21 ) | ( mask2 << 5 ) | 0x001F001F;
+            best.single_filter = false;
+        }
+    }
+
+    *n_accepted = best_accepted;
+    return best;
+}
+
+bool can_filter_accepts(const can_filter_config_t &filter, const can_message_t &frame) {
+    if ( frame.flags & CAN_MSG_FLAG_EXTD ) {
+        return true;
+    }
+
+    uint32_t code = filter.acceptance_code;
+    uint32_t mask = filter.acceptance_mask;
+    uint32_t rtr = frame.flags & CAN_MSG_FLAG_RTR ? 1 : 0;
+    uint32_t data0 = frame.data_length_code > 0 ? frame.data[0] : 0;
+    uint32_t data1 = frame.data_length_code > 1 ? frame.data[1] : 0;
+
+    if ( filter.single_filter ) {
+        uint32_t bits = ( frame.identifier << 21 ) | ( rtr << 20 ) | ( data0 << 8 ) | data1;
+        return ( ( bits ^ code ) & ~mask & 0xFFF0FFFF ) == 0;
+    }
+
+    // Filter 1: ID, RTR and first data byte (split in two nibbles), filter 2: ID and RTR
+    uint32_t bits1 = ( frame.identifier << 21 ) | ( rtr << 20 ) | ( ( data0 >> 4 ) << 16 ) | ( data0 & 0x0F );
+    uint32_t bits2 = ( frame.identifier << 5 ) | ( rtr << 4 );
+
+    bool filter1 = ( ( bits1 ^ code ) & ~mask & 0xFFFF000F ) == 0;
+    bool filter2 = ( ( bits2 ^ code ) & ~mask & 0x0000FFF0 ) == 0;
+
+    return filter1 || filter2;
+}
@@ -0,0 +1,218 @@
+#include <Arduino.h>
+#include <driver/can.h>
+#include <algorithm>
+#include <math.h>
+
+#include "globals.h"
+#include "config.h"
+#include "functions.h"
+#include "can_signals.h"
+#include "can_tx.h"
+
+// Some message # etc. taken from here: https://github.com/openvehicles/Open-Vehicle-Monitoring-System-3/blob/master/vehicle/OVMS.V3/components/vehicle_nissanleaf/src/vehicle_nissanleaf.cpp
+
+static float extract_battery_power(const uint8_t *data) {
+    float current = 0.5 * extract_signal<0, 11, true>(data);    // 11 bits, 0.5A per LSB, 2's complement
+    float voltage = 0.5 * extract_signal<16, 10, false>(data);  // 10 bits, 0.5V per LSB
+
+    return 0.001 * current * voltage;
+}
+
+static constexpr Status_map ac_status_map[] = {
+    { 0, Message_status::ac_is_off },
+    { 1, Message_status::ac_is_on },
+};
+
+static constexpr Status_map charger_status_map[] = {
+    { 0x80, Message_status::charger_idle },
+    { 0x82, Message_status::charger_idle },
+    { 0x92, Message_status::charger_idle },
+    { 0x83, Message_status::charger_quick_charging },
+    { 0x98, Message_status::charger_plugged_in_timer_wait },
+    { 0x88, Message_status::charger_charging },
+    { 0x84, Message_status::charger_finished },
+};
+
+// Signal table, sorted by ID
+static constexpr Can_signal can_signals[] = {
+    // Speed (taken from motor RPM, 100Hz), published at up to 10Hz
+    CAN_SIGNAL( 0x1DA, 32, 15, true, MOTOR_RPM_TO_KMH, 0, Message_name::speed_kmh, EMIT_AVERAGE(10, 0.2, 1000) ),
+
+    // Battery power (100Hz), published at up to 10Hz
+    { 0x1DB, 4, Message_name::battery_power_kw, extract_battery_power, 1, 0, FLT_MAX, NULL, 0, EMIT_AVERAGE(10, 0.2, 1000) },
+
+    // Charger state
+    CAN_SIGNAL( 0x390, 48, 8, false, 0.5, 0, Message_name::charger_max_amps, EMIT_ON_CHANGE(10000) ),
+    CAN_STATUS_SIGNAL( 0x390, 40, 8, charger_status_map, Message_name::charger_status, EMIT_ON_CHANGE(10000) ),
+
+    // Climate control status (10Hz)
+    CAN_STATUS_SIGNAL( 0x54B, 9, 1, ac_status_map, Message_name::ac_status, EMIT_ON_CHANGE(10000) ),
+
+    // Battery energy (2Hz). It is sometimes 81.84kWh (1023 gids) right after switching on the car.
+    { 0x5BC, 2, Message_name::battery_energy_kwh, extract_signal<0, 10, false>, KWH_PER_GID, 0, 81, NULL, 0, EMIT_ON_CHANGE(10000) },
+};
+
+static constexpr int n_signals = sizeof(can_signals) / sizeof(can_signals[0]);
+
+static constexpr bool is_sorted(const Can_signal *signals, int n) {
+    return n < 2 || ( signals[0].id <= signals[1].id && is_sorted(signals + 1, n - 1) );
+}
+static_assert(is_sorted(can_signals, n_signals), "can_signals must be sorted by ID");
+
+// Last reception time, one entry per signal (only the first signal of each ID is used)
+static int64_t last_seen_us[n_signals] = {};
+static uint32_t frame_counts[n_signals] = {};
+
+// Emission state of each signal
+struct Signal_state {
+    float sum;                  // Samples being averaged
+    uint8_t n_samples;
+    int64_t first_sample_us;
+    float last_value;           // Last published value
+    int64_t last_emit_us;       // 0 if never published
+};
+
+static Signal_state signal_states[n_signals] = {};
+
+
+// Index of the first signal of an ID, or -1
+static int find_id(uint32_t id) {
+    const Can_signal *signal = std::lower_bound(can_signals, can_signals + n_signals, id,
+        [](const Can_signal &s, uint32_t id) { return s.id < id; });
+
+    if ( signal == can_signals + n_signals || signal->id != id ) {
+        return -1;
+    }
+    return signal - can_signals;
+}
+
+// Apply the emit policy to a new sample. Returns true if *value (averaged, stamped *timestamp_us) is to be published.
+static bool emit_value(const Emit_policy &policy, Signal_state &state, float *value, int64_t *timestamp_us) {
+    if ( policy.average > 1 ) {
+        // A window left over from before a bus silence would mix old samples in and be stamped in the past
+        if ( state.n_samples > 0 && policy.max_interval_ms > 0
+            && *timestamp_us - state.first_sample_us > policy.max_interval_ms * 1000LL ) {
+            state.sum = 0;
+            state.n_samples = 0;
+        }
+
+        if ( state.n_samples == 0 ) {
+            state.first_sample_us = *timestamp_us;
+        }
+
+        state.sum += *value;
+        state.n_samples++;
+
+        if ( state.n_samples < policy.average ) {
+            return false;
+        }
+
+        // Mean of the samples, stamped in the middle of the window
+        *value = state.sum / state.n_samples;
+        *timestamp_us = state.first_sample_us + ( *timestamp_us - state.first_sample_us ) / 2;
+        state.sum = 0;
+        state.n_samples = 0;
+    }
+
+    int64_t since_emit_us = *timestamp_us - state.last_emit_us;
+
+    bool never_emitted = state.last_emit_us == 0;
+    bool too_soon = since_emit_us < policy.min_interval_ms * 1000LL;
+    bool changed = fabsf(*value - state.last_value) > policy.deadband;
+    bool overdue = policy.max_interval_ms > 0 && since_emit_us >= policy.max_interval_ms * 1000LL;
+
+    if ( !never_emitted && ( too_soon || ( !changed && !overdue ) ) ) {
+        return false;
+    }
+
+    state.last_value = *value;
+    state.last_emit_us = *timestamp_us;
+
+    return true;
+}
+
+int can_decode(const can_message_t &frame, int64_t timestamp_us) {
+    if ( frame.flags & ( CAN_MSG_FLAG_EXTD | CAN_MSG_FLAG_RTR ) ) {
+        return 0;
+    }
+
+    int first = find_id(frame.identifier);
+    if ( first < 0 ) {
+        return 0;
+    }
+
+    last_seen_us[first] = timestamp_us;
+    frame_counts[first]++;
+
+    int published = 0;
+
+    for ( int i = first; i < n_signals && can_signals[i].id == frame.identifier; i++ ) {
+        const Can_signal &signal = can_signals[i];
+
+        if ( frame.data_length_code < signal.min_dlc ) {
+            continue;
+        }
+
+        float raw = signal.extract(frame.data);
+        float value;
+
+        if ( signal.status_map != NULL ) {
+            int m = 0;
+            while ( m < signal.status_map_len && signal.status_map[m].raw != (uint32_t)raw ) {
+                m++;
+            }
+            if ( m == signal.status_map_len ) {
+                continue;
+            }
+            value = signal.status_map[m].status;
+
+            // Confirmation of the commands being sent, whether the status is published or not
+            can_tx_status(signal.target, signal.status_map[m].status, timestamp_us);
+        }
+        else {
+            value = raw * signal.scale + signal.offset;
+
+            if ( value > signal.max_valid ) {
+                continue;
+            }
+        }
+
+        int64_t sample_us = timestamp_us;
+
+        if ( CAN_EMIT_POLICIES && !emit_value(signal.policy, signal_states[i], &value, &sample_us) ) {
+            continue;
+        }
+
+        if ( signal.status_map != NULL ) {
+            send_msg(signal.target, (Message_status)(int)value, sample_us);
+        }
+        else {
+            send_msg(signal.target, value, sample_us);
+        }
+        published++;
+    }
+
+    return published;
+}
+
+int64_t can_last_seen_us(uint32_t id) {
+    int first = find_id(id);
+    return first < 0 ? 0 : last_seen_us[first];
+}
+
+uint32_t can_frame_count(uint32_t id) {
+    int first = find_id(id);
+    return first < 0 ? 0 : frame_counts[first];
+}
+
+int can_decoded_ids(uint32_t *ids, int max_ids) {
+    int n = 0;
+
+    for ( int i = 0; i < n_signals && n < max_ids; i++ ) {
+        if ( n == 0 || ids[n - 1] != can_signals[i].id ) {
+            ids[n++] = can_signals[i].id;
+        }
+    }
+
+    return n;
+}
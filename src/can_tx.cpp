@@ -0,0 +1,247 @@
+#include <Arduino.h>
+#include <driver/can.h>
+
+#include "globals.h"
+#include "config.h"
+#include "functions.h"
+#include "can_bus.h"
+#include "can_signals.h"
+#include "can_tx.h"
+
+#include <esp_timer.h>
+
+enum Tx_request_type {
+    tx_submit,
+    tx_cancel,
+    tx_confirmed,   // Sent by the decoder, wakes the task up
+};
+
+struct Tx_request {
+    Tx_request_type type;
+    Can_tx_job job;
+};
+
+struct Tx_slot {
+    bool active;
+    bool wake_pending;
+    Can_tx_job job;
+    uint8_t attempts;
+    uint8_t frames_sent;
+    int64_t next_due_us;
+    int64_t first_frame_us;     // 0 until the first command frame is sent
+};
+
+// Statuses awaited by the jobs, shared with the decoder
+struct Awaited_status {
+    Message_name name;          // invalid: nothing awaited
+    Message_status status;
+    int64_t since_us;           // Statuses decoded before the first command frame do not count
+    int64_t confirmed_us;       // 0 until confirmed
+};
+
+static QueueHandle_t q_can_tx = xQueueCreate(CAN_TX_MAX_JOBS, sizeof(Tx_request));
+
+static Tx_slot slots[CAN_TX_MAX_JOBS] = {};
+
+static Awaited_status awaited[CAN_TX_MAX_JOBS] = {};
+static portMUX_TYPE awaited_mux = portMUX_INITIALIZER_UNLOCKED;
+
+
+bool can_tx_submit(const Can_tx_job &job) {
+    Tx_request request = { tx_submit, job };
+    return xQueueSendToBack(q_can_tx, &request, 0) == pdTRUE;
+}
+
+bool can_tx_cancel(Message_name name) {
+    Tx_request request = {};
+    request.type = tx_cancel;
+    request.job.request = name;
+    return xQueueSendToBack(q_can_tx, &request, 0) == pdTRUE;
+}
+
+void can_tx_status(Message_name name, Message_status status, int64_t timestamp_us) {
+    bool confirmed = false;
+
+    portENTER_CRITICAL(&awaited_mux);
+    for ( int i = 0; i < CAN_TX_MAX_JOBS; i++ ) {
+        Awaited_status &a = awaited[i];
+        if ( a.name == name && a.status == status && a.since_us != 0 && timestamp_us >= a.since_us && a.confirmed_us == 0 ) {
+            a.confirmed_us = timestamp_us;
+            confirmed = true;
+        }
+    }
+    portEXIT_CRITICAL(&awaited_mux);
+
+    if ( confirmed ) {
+        Tx_request request = {};
+        request.type = tx_confirmed;
+        xQueueSendToBack(q_can_tx, &request, 0);
+    }
+}
+
+static void set_awaited(int i, Message_name name, Message_status status, int64_t since_us) {
+    portENTER_CRITICAL(&awaited_mux);
+    awaited[i].name = name;
+    awaited[i].status = status;
+    awaited[i].since_us = since_us;
+    awaited[i].confirmed_us = 0;
+    portEXIT_CRITICAL(&awaited_mux);
+}
+
+static Command_event job_event(const Can_tx_job &job, Message_status result) {
+    Command_event event = {};
+    event.request = job.request;
+    event.request_status = job.request_status;
+    event.result = result;
+    event.command_id = job.command_id;
+    return event;
+}
+
+// confirmed_us: time of the confirmation, 0 if none
+static void finish(int i, Message_status result, int64_t confirmed_us) {
+    Tx_slot &slot = slots[i];
+
+    Command_event event = job_event(slot.job, result);
+    event.frames_sent = slot.frames_sent;
+    if ( slot.first_frame_us != 0 ) {
+        event.sent_after_us = slot.first_frame_us - slot.job.requested_us;
+    }
+    if ( confirmed_us != 0 ) {
+        event.confirmed_after_us = confirmed_us - slot.job.requested_us;
+    }
+    send_msg(Message_name::command_event, event);
+
+    slot.active = false;
+    set_awaited(i, Message_name::invalid, Message_status::invalid_status, 0);
+}
+
+static void handle_request(const Tx_request &request) {
+    if ( request.type == tx_confirmed ) {
+        return;
+    }
+
+    for ( int i = 0; i < CAN_TX_MAX_JOBS; i++ ) {
+        if ( slots[i].active && slots[i].job.request == request.job.request ) {
+            finish(i, Message_status::command_cancelled, 0);
+        }
+    }
+
+    if ( request.type == tx_cancel ) {
+        return;
+    }
+
+    for ( int i = 0; i < CAN_TX_MAX_JOBS; i++ ) {
+        if ( !slots[i].active ) {
+            slots[i].active = true;
+            slots[i].wake_pending = request.job.wake;
+            slots[i].job = request.job;
+            slots[i].attempts = 0;
+            slots[i].frames_sent = 0;
+            slots[i].next_due_us = esp_timer_get_time();
+            slots[i].first_frame_us = 0;
+            return;
+        }
+    }
+
+    // No free slot
+    send_msg(Message_name::command_event, job_event(request.job, Message_status::command_failed));
+}
+
+// Time of the confirmation of a slot, 0 if not (yet) confirmed
+static int64_t confirmed_us(int i) {
+    portENTER_CRITICAL(&awaited_mux);
+    int64_t t = awaited[i].confirmed_us;
+    portEXIT_CRITICAL(&awaited_mux);
+
+    return t;
+}
+
+static void run_slot(int i, int64_t now) {
+    Tx_slot &slot = slots[i];
+    bool needs_confirmation = slot.job.confirm_name != Message_name::invalid;
+
+    if ( slot.first_frame_us != 0 && needs_confirmation ) {
+        int64_t t = confirmed_us(i);
+
+        if ( t != 0 ) {
+            finish(i, Message_status::command_confirmed, t);
+            return;
+        }
+
+        if ( now - slot.first_frame_us >= slot.job.timeout_ms * 1000LL ) {
+            finish(i, Message_status::command_timeout, 0);
+            return;
+        }
+    }
+
+    if ( slot.next_due_us > now ) {
+        return;
+    }
+
+    if ( slot.wake_pending ) {
+        can_message_t wake = {};
+        wake.identifier = CAN_ID_WAKE;
+        wake.data_length_code = 1;
+        wake.flags = CAN_MSG_FLAG_NONE;
+
+        ESP_ERROR_CHECK_WITHOUT_ABORT(can_bus_transmit(&wake, 0));
+
+        slot.wake_pending = false;
+        slot.next_due_us += CAN_TX_WAKE_DELAY_MS * 1000LL;
+        return;
+    }
+
+    // The driver TX queue is never waited for: a frame that does not fit counts as a failed repetition
+    if ( can_bus_transmit(&slot.job.frame, 0) == ESP_OK ) {
+        slot.frames_sent++;
+    }
+    slot.attempts++;
+
+    if ( slot.first_frame_us == 0 ) {
+        slot.first_frame_us = now;
+        if ( needs_confirmation ) {
+            set_awaited(i, slot.job.confirm_name, slot.job.confirm_status, now);
+        }
+    }
+
+    if ( slot.attempts < slot.job.repeats ) {
+        slot.next_due_us += slot.job.interval_ms * 1000LL;
+    }
+    else if ( needs_confirmation ) {
+        // No more frames, wait for the confirmation until the timeout
+        slot.next_due_us = slot.first_frame_us + slot.job.timeout_ms * 1000LL;
+    }
+    else {
+        finish(i, slot.frames_sent > 0 ? Message_status::command_sent : Message_status::command_failed, 0);
+    }
+}
+
+void can_tx_task( void *parameter ) {
+    for (;;) {
+        // Sleep until the next frame or timeout is due, or a request or confirmation arrives
+        int64_t next_due_us = INT64_MAX;
+        for ( int i = 0; i < CAN_TX_MAX_JOBS; i++ ) {
+            if ( slots[i].active && slots[i].next_due_us < next_due_us ) {
+                next_due_us = slots[i].next_due_us;
+            }
+        }
+
+        TickType_t wait = portMAX_DELAY;
+        if ( next_due_us != INT64_MAX ) {
+            int64_t wait_us = next_due_us - esp_timer_get_time();
+            wait = wait_us > 0 ? pdMS_TO_TICKS( ( wait_us + 999 ) / 1000 ) : 0;
+        }
+
+        Tx_request request;
+        if ( xQueueReceive(q_can_tx, &request, wait) == pdTRUE ) {
+            handle_request(request);
+        }
+
+        int64_t now = esp_timer_get_time();
+        for ( int i = 0; i < CAN_TX_MAX_JOBS; i++ ) {
+            if ( slots[i].active ) {
+                run_slot(i, now);
+            }
+        }
+    }
+}
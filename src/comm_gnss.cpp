@@ -2,39 +2,73 @@
 
 #include <globals.h>
 #include <functions.h>
+#include <telemetry.h>
+#include <msg_bus.h>
+#include <can_bus.h>
+#include <mqtt_backlog.h>
+#include <gnss_urc.h>
+#include <wall_clock.h>
+#include <mqtt_schedule.h>
+#include <track.h>
+#include <lbc.h>
+#include <mqtt_commands.h>
 #include <config.h>
 #include <config_comm.h>
 
 #define TINY_GSM_MODEM_SIM7000
-#define TINY_GSM_DEBUG Serial
+#define TINY_GSM_DEBUG debug_serial
 #include <TinyGsmClient.h>
 #include <PubSubClient.h>
 
 #include <StreamDebugger.h>
+#include <esp_timer.h>
 
 void mqttCallback(char* topic, byte* payload, unsigned int len) {
     if (strcmp(topic, MQTT_CONTROL_TOPIC) == 0) {
-        if (memcmp(payload, "poll", 4) == 0) {
-            send_msg(Message_name::update_request);
-        }
-        else if (memcmp(payload, "start_ac", 8) == 0) {
-            send_msg(Message_name::ac_request, Message_status::request_ac_start);
-        }
-        else if (memcmp(payload, "stop_ac", 7) == 0) {
-            send_msg(Message_name::ac_request, Message_status::request_ac_stop);
-        }
-        else if (memcmp(payload, "start_charge", 12) == 0) {
-            send_msg(Message_name::charge_request, Message_status::request_charge_start);
-        }
-        else if (memcmp(payload, "lock_doors", 10) == 0) {
-            send_msg(Message_name::doors_request, Message_status::request_doors_lock);
-        }
-        else if (memcmp(payload, "unlock_doors", 12) == 0) {
-            send_msg(Message_name::doors_request, Message_status::request_doors_unlock);
+        command_received(payload, len, esp_timer_get_time());
+    }
+}
+
+// Publishes of one cycle, with the size of their MQTT PUBLISH packets
+struct Publish_cycle {
+    int publishes;
+    uint32_t packet_bytes;
+};
+
+static bool publish_counted(PubSubClient &mqtt, const char *topic, const char *payload, Publish_cycle *cycle) {
+    // Fixed header (type and remaining length), topic length, topic, payload
+    uint32_t remaining = 2 + strlen(topic) + strlen(payload);
+    cycle->packet_bytes += 1 + ( remaining < 128 ? 1 : 2 ) + remaining;
+    cycle->publishes++;
+
+    return mqtt.publish(topic, payload);
+}
+
+// Publish the oldest records queued while offline on MQTT_PREFIX "backlog", at most BACKLOG_DRAIN_PER_CYCLE.
+// age_ms is the time since the scheduled publish and time its UTC time (epoch ms), when the record was queued since the last boot.
+static void drain_backlog(PubSubClient &mqtt) {
+    static Backlog_record record;
+    static char wrapped[BACKLOG_RECORD_SIZE + 128];
+
+    for (int i = 0; i < BACKLOG_DRAIN_PER_CYCLE && backlog_front(&record); i++) {
+        int n = snprintf(wrapped, sizeof(wrapped), "{\"topic\":\"%s\",\"seq\":%u,\"boot\":%u,\"t_ms\":%lld,",
+            record.topic, (unsigned)record.seq, (unsigned)record.boot, (long long)(record.timestamp_us / 1000));
+
+        if (record.boot == backlog_boot()) {
+            n += snprintf(wrapped + n, sizeof(wrapped) - n, "\"age_ms\":%lld,", (long long)((esp_timer_get_time() - record.timestamp_us) / 1000));
+
+            if (clock_valid()) {
+                n += snprintf(wrapped + n, sizeof(wrapped) - n, "\"time\":%lld,", (long long)(clock_epoch_us(record.timestamp_us) / 1000));
+            }
         }
-        else if (memcmp(payload, "toggle_slcan", 12) == 0) {
-            send_msg(Message_name::toggle_slcan, Message_status::no_status);
+
+        snprintf(wrapped + n, sizeof(wrapped) - n, "\"data\":%s}", record.payload);
+
+        if (!mqtt.publish(MQTT_PREFIX "backlog", wrapped)) {
+            break;
         }
+
+        backlog_pop(record.seq);
     }
 }
 
@@ -51,50 +85,238 @@ boolean mqttConnect(PubSubClient &mqtt) {
     return mqtt.connected();
 }
 
-void modemInit(TinyGsm &modem) {
-    modem.restart();
-    modem.setNetworkMode(51); // GSM and LTE
-    modem.setPreferredMode(1); // Cat-M
-    modem.waitForNetwork();
-    modem.enableGPS();
+static void print_clock_sync(const char *source) {
+    Clock_stats stats;
+    clock_stats(&stats);
+
+    debug_printf("Clock: %s sync, error %lld ms, drift %.1f ppm\n", source, (long long)(stats.last_error_us / 1000), stats.drift_ppm);
+}
+
+// GNSS reports every GNSS_URC_FIXES fixes, parsed by Gnss_urc_stream
+static void gnss_enable_reports(TinyGsm &modem) {
+    modem.sendAT("+CGNSURC=", GNSS_URC_FIXES);
+    modem.waitResponse(1000);
+}
+
+// Connection to the broker, one short step per call so that the task keeps serving GNSS and the queue.
+// Waiting states poll every MODEM_POLL_INTERVAL_MS and fail after their timeout. Failures are retried after
+// an exponential backoff, the modem is reset every MODEM_RESET_AFTER_FAILURES consecutive failures.
+enum class Link_state {
+    modem_reset,
+    modem_wait_at,
+    network_wait,
+    gprs_connect,
+    mqtt_connect,
+    connected,
+    backoff,
+};
+
+static const char *link_state_names[] = { "modem_reset", "modem_wait_at", "network_wait", "gprs_connect", "mqtt_connect", "connected", "backoff" };
+
+struct Link {
+    Link_state state;
+    Link_state retry_state;     // Resumed after the backoff
+    uint32_t entered_ms;
+    uint32_t last_poll_ms;
+    uint32_t backoff_ms;
+    int failures;               // Consecutive
+    int gprs_step;              // Next command of gprs_steps
+    bool at_pending;            // The response of a command is awaited, no other AT command may be sent
+    uint32_t at_sent_ms;
+};
+
+// GPRS bring-up of the SIM7000 (the AT sequence of TinyGsm::gprsConnect()), one command at a time: each command is
+// sent, then its response is polled for MODEM_RESPONSE_POLL_MS per call, until its own timeout
+struct Gprs_step {
+    const char *command;
+    const char *response;
+    uint32_t timeout_ms;
+};
+
+static const Gprs_step gprs_steps[] = {
+    { "+CIPSHUT", "SHUT OK", 65000 },
+    { "+CGDCONT=1,\"IP\",\"" GSM_APN "\"", "OK", 1000 },
+    { "+CGATT=1", "OK", 75000 },
+    { "+CIPMUX=1", "OK", 1000 },
+    { "+CIPQSEND=1", "OK", 1000 },
+    { "+CIPRXGET=1", "OK", 1000 },
+    { "+CSTT=\"" GSM_APN "\",\"\",\"\"", "OK", 60000 },
+    { "+CIICR", "OK", 85000 },
+    { "+CDNSCFG=\"8.8.8.8\",\"8.8.4.4\"", "OK", 1000 },
+};
+
+static constexpr int n_gprs_steps = sizeof(gprs_steps) / sizeof(gprs_steps[0]);
+
+// PubSubClient opens the connection with the client's default timeout, 75 s for the TLS connect of TinyGSM
+class Modem_client : public TinyGsmClientSecure {
+public:
+    Modem_client(TinyGsm &modem) : TinyGsmClientSecure(modem) {}
+
+    using TinyGsmClientSecure::connect;
+    int connect(const char *host, uint16_t port) override {
+        return TinyGsmClientSecure::connect(host, port, MODEM_CONNECT_TIMEOUT_S);
+    }
+};
+
+static void link_enter(Link &link, Link_state state) {
+    debug_printf("Modem: %s -> %s after %u ms\n", link_state_names[(int)link.state], link_state_names[(int)state], (unsigned)(millis() - link.entered_ms));
+
+    link.state = state;
+    link.entered_ms = millis();
+    link.last_poll_ms = 0;
+    link.gprs_step = 0;
+    link.at_pending = false;
+}
+
+static void link_fail(Link &link, Link_state retry_state) {
+    link.failures++;
+    link.retry_state = link.failures % MODEM_RESET_AFTER_FAILURES == 0 ? Link_state::modem_reset : retry_state;
+
+    link.backoff_ms = MODEM_BACKOFF_MIN_MS;
+    for (int i = 1; i < link.failures && link.backoff_ms < MODEM_BACKOFF_MAX_MS; i++) {
+        link.backoff_ms *= 2;
+    }
+    if (link.backoff_ms > MODEM_BACKOFF_MAX_MS) {
+        link.backoff_ms = MODEM_BACKOFF_MAX_MS;
+    }
+
+    link_enter(link, Link_state::backoff);
+}
+
+// True once per MODEM_POLL_INTERVAL_MS in waiting states
+static bool link_poll_due(Link &link) {
+    if (link.last_poll_ms != 0 && millis() - link.last_poll_ms < MODEM_POLL_INTERVAL_MS) {
+        return false;
+    }
+    link.last_poll_ms = millis();
+    return true;
+}
+
+static void link_step(Link &link, TinyGsm &modem, PubSubClient &mqtt) {
+    uint32_t in_state_ms = millis() - link.entered_ms;
+
+    switch (link.state) {
+        case Link_state::modem_reset:
+            modem.sendAT("+CFUN=1,1");
+            modem.waitResponse(1000);
+            link_enter(link, Link_state::modem_wait_at);
+            break;
+
+        case Link_state::modem_wait_at:
+            if (link_poll_due(link) && modem.testAT(100)) {
+                // Fails without a SIM card
+                if (modem.init()) {
+                    modem.setNetworkMode(51); // GSM and LTE
+                    modem.setPreferredMode(1); // Cat-M
+                    modem.enableGPS();
+                    gnss_enable_reports(modem);
+                    link_enter(link, Link_state::network_wait);
+                }
+                else {
+                    link_fail(link, Link_state::modem_wait_at);
+                }
+            }
+            else if (in_state_ms > MODEM_AT_TIMEOUT_MS) {
+                link_fail(link, Link_state::modem_reset);
+            }
+            break;
+
+        case Link_state::network_wait:
+            if (link_poll_due(link) && modem.isNetworkConnected()) {
+                link_enter(link, Link_state::gprs_connect);
+            }
+            else if (in_state_ms > MODEM_NETWORK_TIMEOUT_MS) {
+                link_fail(link, Link_state::network_wait);
+            }
+            break;
+
+        case Link_state::gprs_connect:
+            if (link.gprs_step == 0 && !link.at_pending && !modem.isNetworkConnected()) {
+                link_enter(link, Link_state::network_wait);
+            }
+            else if (link.gprs_step == 0 && !link.at_pending && modem.isGprsConnected()) {
+                link_enter(link, Link_state::mqtt_connect);
+            }
+            else if (!link.at_pending) {
+                modem.sendAT(gprs_steps[link.gprs_step].command);
+                link.at_pending = true;
+                link.at_sent_ms = millis();
+            }
+            else {
+                const Gprs_step &step = gprs_steps[link.gprs_step];
+                int8_t response = modem.waitResponse(MODEM_RESPONSE_POLL_MS, reinterpret_cast<GsmConstStr>(step.response));
+
+                if (response == 1) {
+                    link.at_pending = false;
+                    link.gprs_step++;
+                    if (link.gprs_step == n_gprs_steps) {
+                        link_enter(link, Link_state::mqtt_connect);
+                    }
+                }
+                else if (response != 0 || millis() - link.at_sent_ms > step.timeout_ms) {
+                    debug_printf("Modem: AT%s failed\n", step.command);
+                    link_fail(link, Link_state::gprs_connect);
+                }
+            }
+            break;
+
+        case Link_state::mqtt_connect:
+            if (!modem.isGprsConnected()) {
+                link_enter(link, Link_state::gprs_connect);
+            }
+            else if (mqttConnect(mqtt)) {
+                link.failures = 0;
+                link_enter(link, Link_state::connected);
+            }
+            else {
+                link_fail(link, Link_state::mqtt_connect);
+            }
+            break;
+
+        case Link_state::connected:
+            if (!mqtt.connected()) {
+                link_enter(link, Link_state::mqtt_connect);
+            }
+            break;
+
+        case Link_state::backoff:
+            if (in_state_ms > link.backoff_ms) {
+                link_enter(link, link.retry_state);
+            }
+            break;
+    }
 }
 
 void comm_gnss_task( void *parameter ) {
     //StreamDebugger debugger(Serial1, Serial);
-    TinyGsm modem(Serial1);
-    TinyGsmClientSecure client(modem);
-    PubSubClient mqtt(client);
+    static Gnss_urc_stream gnss_stream(Serial1);
+    static TinyGsm modem(gnss_stream);
+    static Modem_client client(modem);
+    static PubSubClient mqtt(client);
 
     Serial1.begin(115200, SERIAL_8N1, 34, 33);
 
     mqtt.setServer(MQTT_BROKER, MQTT_PORT);
     mqtt.setCallback(mqttCallback);
+    mqtt.setBufferSize(MQTT_BUFFER_SIZE);
 
-    // Local storage of values
+    // Local storage of values (others are read from the telemetry store)
     float battery_power_kw = 0;
-    float battery_energy_kwh = 0;
-    float charger_max_amps = 0;
-    float gnss_latitude = 0;
-    float gnss_longitude = 0;
-    float gnss_altitude = 0;
-    float gnss_speed = 0;
-    float pressure_altitude = 0;
-    float pcb_temperature = 0;
-    Message_status ac_status = Message_status::invalid_status;
-    Message_status charger_status = Message_status::invalid_status;
-    Message_status car_status = Message_status::invalid_status;
-    Message_status network_status = Message_status::invalid_status;
-    int gsm_day;
-    int gsm_month;
-    int gsm_year;
-    int gsm_hours;
-    int gsm_minutes;
-    int gsm_seconds;
-
-    int32_t lastReconnectAttempt = -999999; // Negative value to avoid waiting 10s before connecting at boot
-    int32_t lastGNSSUpdate = 0;
-    int32_t lastDateTimeUpdate = 0;
-    int32_t lastMqttUpdate = 0;
+    int64_t last_power_time_us = 0;
+    Gnss_fix gnss_fix = {};
+    bool have_gnss_fix = false;
+    int64_t gnss_fix_time_us = 0;
+    bool was_driving = false;
+    // Static: about 1 kB, the task has a 4 kB stack
+    static Telemetry telemetry;
+
+    Link link = {};
+    int64_t lastGnssEnable = 0;
+    int32_t lastNetworkTimeAttempt = -999999;
+    int32_t lastDiagUpdate = 0;
+    int32_t lastBacklogDrain = 0;
+    int64_t lastCellsPublished = 0;
+    int64_t cellsPublishedTime = 0;
 
     boolean updateRequestFlag = false;
 
@@ -102,142 +324,209 @@ void comm_gnss_task( void *parameter ) {
         // UBaseType_t highWatermark = uxTaskGetStackHighWaterMark(NULL);
         // printf("Comm task high watermark: %d\n", highWatermark);
         // Make sure we stay connected
-        if (!mqtt.connected()) {
-            // Reconnect every 10 seconds
-            int32_t t = millis();
-
-            if (t - lastReconnectAttempt > 10000L) {
-
-                lastReconnectAttempt = t;
-
-                if (!modem.isNetworkConnected()) {
-                    modemInit(modem);
-                }
-
-                if (!modem.isGprsConnected()) {
-                    modem.gprsConnect(GSM_APN, "", "");
-                }
-
-                if (mqttConnect(mqtt)) {
-                    lastReconnectAttempt = 0;
-                }
-            }
-            delay(100);
-        }
+        link_step(link, modem, mqtt);
         mqtt.loop();
+        backlog_set_online(mqtt.connected());
 
         // Empty the queue and update local variables
         Message received_msg;
         while ( xQueueReceive(q_comm_gnss, &received_msg, 0 ) == pdTRUE ) {
             switch ( received_msg.name ) {
                 case Message_name::battery_power_kw:
-                    exp_smooth(&battery_power_kw, received_msg.value_float, MQTT_SMOOTHING);
+                    exp_smooth(&battery_power_kw, received_msg.value_float, MQTT_SMOOTHING, received_msg.timestamp_us - last_power_time_us);
+                    last_power_time_us = received_msg.timestamp_us;
                     break;
 
-                case Message_name::battery_energy_kwh:
-                    battery_energy_kwh = received_msg.value_float;
+                case Message_name::update_request:
+                    updateRequestFlag = true;
                     break;
 
-                case Message_name::car_status:
-                    car_status = received_msg.value_status;
+                case Message_name::command_event:
+                    command_finished(received_msg.value_command_event);
                     break;
 
-                case Message_name::ac_status:
-                    ac_status = received_msg.value_status;
+                default:
                     break;
+            }
+        }
 
-                case Message_name::charger_status:
-                    charger_status = received_msg.value_status;
-                    break;
+        // Command acknowledgements and outcomes
+        static char response[256];
+        while (command_next_response(response, sizeof(response))) {
+            if (!mqtt.publish(MQTT_PREFIX "response", response)) {
+                backlog_push("response", response, esp_timer_get_time());
+            }
+        }
 
-                case Message_name::charger_max_amps:
-                    charger_max_amps = received_msg.value_float;
-                    break;
+        // Update GNSS from the reports received so far
+        gnss_stream.poll();
+
+        Gnss_report gnss_report;
+        if (gnss_stream.read_report(&gnss_report) && gnss_report.fix) {
+            gnss_fix = gnss_report.position;
+            have_gnss_fix = true;
+            gnss_fix_time_us = gnss_report.timestamp_us;
+            send_msg(Message_name::gnss_fix, gnss_fix, gnss_report.timestamp_us);
+
+            if (gnss_report.utc_valid && clock_sync_due(clock_gnss)) {
+                Date_time &utc = gnss_report.utc;
+                clock_sync(clock_epoch_from_utc(2000 + utc.year, utc.month, utc.day, utc.hours, utc.minutes, utc.seconds),
+                    gnss_report.timestamp_us - GNSS_URC_LATENCY_MS * 1000LL, clock_gnss);
+                print_clock_sync("GNSS");
+            }
+        }
 
-                case Message_name::update_request:
-                    updateRequestFlag = true;
-                    break;
+        // Reports are off after a modem reset or a GNSS power cycle: enable them again once the modem answers
+        int64_t now_us = esp_timer_get_time();
+        if (link.state >= Link_state::network_wait && link.state != Link_state::backoff && !link.at_pending
+            && now_us - gnss_stream.last_report_us() > GNSS_URC_TIMEOUT_MS * 1000LL
+            && now_us - lastGnssEnable > GNSS_URC_TIMEOUT_MS * 1000LL) {
+            lastGnssEnable = now_us;
+            modem.enableGPS();
+            gnss_enable_reports(modem);
+        }
 
-                case Message_name::pcb_temperature:
-                    pcb_temperature = received_msg.value_float;
-                    break;
+        // Network time (AT+CCLK, local time and zone) until GNSS time is available
+        if (millis() - lastNetworkTimeAttempt > CLOCK_NETWORK_RETRY_S * 1000L && clock_sync_due(clock_network)
+            && link.state >= Link_state::network_wait && link.state != Link_state::backoff && !link.at_pending) {
+            lastNetworkTimeAttempt = millis();
 
-                case Message_name::pressure_altitude:
-                    pressure_altitude = received_msg.value_float;
-                    break;
+            int year, month, day, hours, minutes, seconds;
+            float timezone_h;
+            int64_t request_us = esp_timer_get_time();
 
-                default:
-                    break;
+            // Not set (2000 or 1980 depending on the firmware) until the network sent its time
+            if (modem.getNetworkTime(&year, &month, &day, &hours, &minutes, &seconds, &timezone_h) && year >= 2020) {
+                int64_t local_us = clock_epoch_from_utc(year, month, day, hours, minutes, seconds);
+                clock_sync(local_us - (int64_t)(timezone_h * 3600) * 1000000LL, (request_us + esp_timer_get_time()) / 2, clock_network);
+                print_clock_sync("network");
             }
         }
 
-        // Update GNSS
-        if (millis() - lastGNSSUpdate > 500) {
-            lastGNSSUpdate = millis();
+        telemetry_read(&telemetry);
 
-            modem.getGPS(&gnss_latitude, &gnss_longitude, &gnss_speed, &gnss_altitude, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL);
+        Message_status charger_status = telemetry.values[Message_name::charger_status].value_status;
+        Message_status car_status = telemetry.values[Message_name::car_status].value_status;
 
-            send_msg(Message_name::gnss_latitude, gnss_latitude);
-            send_msg(Message_name::gnss_longitude, gnss_longitude);
-            send_msg(Message_name::gnss_speed, gnss_speed);
-            send_msg(Message_name::gnss_altitude, gnss_altitude);
+        // Track of the trips, segments published as they are closed
+        bool driving = car_status == Message_status::car_is_on;
+        if (driving && gnss_fix_time_us != 0) {
+            track_add(gnss_fix, gnss_fix_time_us);
         }
-
-        // Update date and time
-        if (millis() - lastDateTimeUpdate > 1000) {
-            lastDateTimeUpdate = millis();
-
-            String gsm_date_time = modem.getGSMDateTime(TinyGSMDateTimeFormat::DATE_FULL);
-
-            gsm_year = gsm_date_time.substring(0, 2).toInt();
-            gsm_month = gsm_date_time.substring(3, 5).toInt();
-            gsm_day = gsm_date_time.substring(6, 8).toInt();
-            gsm_hours = gsm_date_time.substring(9, 11).toInt();
-            gsm_minutes = gsm_date_time.substring(12, 14).toInt();
-            gsm_seconds = gsm_date_time.substring(15, 17).toInt();
-
-            send_msg(Message_name::gsm_year, gsm_year);
-            send_msg(Message_name::gsm_month, gsm_month);
-            send_msg(Message_name::gsm_day, gsm_day);
-            send_msg(Message_name::gsm_hours, gsm_hours);
-            send_msg(Message_name::gsm_minutes, gsm_minutes);
-            send_msg(Message_name::gsm_seconds, gsm_seconds);
+        else if (!driving && was_driving) {
+            track_end();
         }
+        was_driving = driving;
+        gnss_fix_time_us = 0;
+
+        static Track_segment segment;
+        while (track_upload_next(&segment)) {
+            static char payload[BACKLOG_RECORD_SIZE];
+            track_format_json(segment, payload, sizeof(payload));
 
-        // Publish messages on MQTT
-        // Default once an hour
-        int publish_interval_s = 3600;
+            if (!mqtt.connected() || !mqtt.publish(MQTT_PREFIX "track", payload)) {
+                backlog_push("track", payload, esp_timer_get_time());
+            }
+        }
 
-        // Publish more frequently when charging or when car is on
-        if (charger_status == Message_status::charger_quick_charging) {
-            publish_interval_s = 10;
+        // Cell voltages, the latest snapshot in one message
+        int64_t cells_time_us = telemetry.values[Message_name::cell_voltages].timestamp_us;
+        if (mqtt.connected() && cells_time_us != cellsPublishedTime
+            && (lastCellsPublished == 0 || esp_timer_get_time() - lastCellsPublished > LBC_CELLS_PUBLISH_INTERVAL_S * 1000000LL)) {
+            static Battery_cells cells;
+            static char payload[640];
+            lbc_read(&cells);
+            lbc_format_json(cells, payload, sizeof(payload));
+
+            if (mqtt.publish(MQTT_PREFIX "cells", payload)) {
+                lastCellsPublished = esp_timer_get_time();
+                cellsPublishedTime = cells_time_us;
+            }
         }
-        else if (charger_status == Message_status::charger_charging) {
-            publish_interval_s = 600;
+
+        // Publish the values that are due according to their policy (all of them on request)
+        bool active = car_status == Message_status::car_is_on
+            || charger_status == Message_status::charger_charging || charger_status == Message_status::charger_quick_charging;
+
+        Publish_inputs inputs = { &telemetry, have_gnss_fix ? &gnss_fix : NULL, battery_power_kw };
+        int64_t cycle_start_us = esp_timer_get_time();
+        // Offline from boot too: the values are queued in the backlog
+        uint32_t due = mqtt_schedule_due(inputs, active, updateRequestFlag, cycle_start_us);
+        updateRequestFlag = false;
+
+        if (due != 0) {
+            Publish_cycle cycle = {};
+            uint32_t sent = 0;
+            static char payload[512];
+
+            if (mqtt.connected() && MQTT_PACKED_PAYLOAD) {
+                // One JSON object
+                mqtt_schedule_format_packed(due, payload, sizeof(payload));
+
+                if (publish_counted(mqtt, MQTT_PREFIX "telemetry", payload, &cycle)) {
+                    sent = due;
+                }
+            }
+            else if (mqtt.connected()) {
+                for (int i = 0; i < mqtt_topic_count(); i++) {
+                    if (!(due & (1UL << i))) {
+                        continue;
+                    }
+
+                    char topic[48];
+                    char value[24];
+                    snprintf(topic, sizeof(topic), MQTT_PREFIX "%s", mqtt_topic_name(i));
+                    mqtt_topic_format(i, value, sizeof(value));
+
+                    if (publish_counted(mqtt, topic, value, &cycle)) {
+                        sent |= 1UL << i;
+                    }
+                }
+            }
+
+            // Offline or failed: one JSON object in the backlog, sent once the connection is back
+            uint32_t failed = due & ~sent;
+            if (failed != 0) {
+                mqtt_schedule_format_packed(failed, payload, sizeof(payload));
+                backlog_push("telemetry", payload, cycle_start_us);
+                sent = due;
+            }
+
+            mqtt_schedule_sent(sent, cycle_start_us);
+
+            if (cycle.publishes > 0) {
+                debug_printf("MQTT cycle: %d publish(es), %u bytes, %lld ms\n",
+                    cycle.publishes, (unsigned)cycle.packet_bytes, (long long)( ( esp_timer_get_time() - cycle_start_us ) / 1000 ));
+            }
         }
-        else if (car_status == Message_status::car_is_on) {
-            publish_interval_s = 60;
+
+        // Queued values, after the live ones
+        if (mqtt.connected() && millis() - lastBacklogDrain > BACKLOG_DRAIN_INTERVAL_MS) {
+            lastBacklogDrain = millis();
+            drain_backlog(mqtt);
         }
 
-        if (millis() - lastMqttUpdate > publish_interval_s * 1000 || updateRequestFlag) {
-            updateRequestFlag = false;
-            lastMqttUpdate = millis();
+        // Publish queue statistics
+        if (DIAG_PUBLISH_INTERVAL_S > 0 && millis() - lastDiagUpdate > DIAG_PUBLISH_INTERVAL_S * 1000L && mqtt.connected()) {
+            lastDiagUpdate = millis();
 
-            mqtt.publish(MQTT_PREFIX "lat", String(gnss_latitude, 6).c_str());
-            mqtt.publish(MQTT_PREFIX "lon", String(gnss_longitude, 6).c_str());
-            mqtt.publish(MQTT_PREFIX "speed", String(gnss_speed, 1).c_str());
-            mqtt.publish(MQTT_PREFIX "batteryKWH", String(battery_energy_kwh, 1).c_str());
-            mqtt.publish(MQTT_PREFIX "batteryKW", String(battery_power_kw, 1).c_str());
-            mqtt.publish(MQTT_PREFIX "chargerMaxAmps", String(charger_max_amps, 1).c_str());
+            static char diag[512];
+            msg_format_stats(diag, sizeof(diag));
+            mqtt.publish(MQTT_PREFIX "diag/queues", diag);
 
-            mqtt.publish(MQTT_PREFIX "altitude", String(pressure_altitude, 1).c_str());
-            mqtt.publish(MQTT_PREFIX "pcbTemperature", String(pcb_temperature, 1).c_str());
+            can_bus_format_stats(diag, sizeof(diag));
+            mqtt.publish(MQTT_PREFIX "diag/can", diag);
 
-            // Status: send the integer value of the Message_status enum
-            mqtt.publish(MQTT_PREFIX "acStatus", String(ac_status).c_str());
-            mqtt.publish(MQTT_PREFIX "chargerStatus", String(charger_status).c_str());
+            backlog_format_stats(diag, sizeof(diag));
+            mqtt.publish(MQTT_PREFIX "diag/backlog", diag);
+
+            track_format_stats(diag, sizeof(diag));
+            mqtt.publish(MQTT_PREFIX "diag/track", diag);
+
+            command_format_stats(diag, sizeof(diag));
+            mqtt.publish(MQTT_PREFIX "diag/commands", diag);
         }
-        
+
         delay(10);
         }
 }
@@ -36,6 +36,8 @@ void display_task( void *parameter ) {
     float battery_kwh = 22.87543;
     float speed = 128.721;
     float last_speed = 0;
+    int64_t last_speed_time_us = 0;
+    int64_t last_power_time_us = 0;
     float acceleration = 0.8;
     float power = 78.921;
     Message_status charger_status = Message_status::charger_idle;
@@ -56,14 +58,24 @@ void display_task( void *parameter ) {
                     battery_kwh = received_msg.value_float;
                     break;
 
-                case Message_name::speed_kmh:
-                    exp_smooth(&speed, received_msg.value_float, DISPLAY_SMOOTHING);
-                    exp_smooth(&acceleration, ( speed - last_speed ) * 100, DISPLAY_SMOOTHING);  // 100Hz message --> km/h / s
+                case Message_name::speed_kmh: {
+                    int64_t dt_us = received_msg.timestamp_us - last_speed_time_us;
+
+                    exp_smooth(&speed, received_msg.value_float, DISPLAY_SMOOTHING, dt_us);
+
+                    // km/h / s, from the real interval between samples
+                    if ( last_speed_time_us != 0 && dt_us > 0 ) {
+                        exp_smooth(&acceleration, ( speed - last_speed ) * 1e6 / dt_us, DISPLAY_SMOOTHING, dt_us);
+                    }
+
                     last_speed = speed;
+                    last_speed_time_us = received_msg.timestamp_us;
                     break;
+                }
 
                 case Message_name::battery_power_kw:
-                    exp_smooth(&power, received_msg.value_float, DISPLAY_SMOOTHING);
+                    exp_smooth(&power, received_msg.value_float, DISPLAY_SMOOTHING, received_msg.timestamp_us - last_power_time_us);
+                    last_power_time_us = received_msg.timestamp_us;
                     break;
 
                 case Message_name::logger_status:
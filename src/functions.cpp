@@ -1,6 +1,13 @@
 #include "functions.h"
 #include <Arduino.h>
 #include "globals.h"
+#include "config.h"
+#include "msg_bus.h"
+#include "slcan.h"
+
+#include <esp_timer.h>
+#include <math.h>
+#include <stdarg.h>
 
 // Function that converts a two's complement n bits number into a signed int
 int twosComplementToInt(uint32_t twosComplement, uint32_t nBits) {
@@ -27,36 +34,111 @@ void exp_smooth(float *out, float in, float smoothing ) {
     *out = smoothing * *out + (1 - smoothing) * in;
 }
 
+void exp_smooth(float *out, float in, float smoothing, int64_t dt_us) {
+    if ( dt_us <= 0 ) {
+        dt_us = SMOOTHING_PERIOD_US;
+    }
+
+    exp_smooth(out, in, powf(smoothing, (float)dt_us / SMOOTHING_PERIOD_US));
+}
+
 
-// Sending a message on the q_out queue
+// Publishing a message to its subscribers, from the context of the calling task
 void send_msg(Message msg_out) {
-    xQueueSendToBack(q_out, &msg_out, 0);
+    if ( msg_out.timestamp_us == 0 ) {
+        msg_out.timestamp_us = esp_timer_get_time();
+    }
+
+    msg_publish(msg_out);
 }
-void send_msg(Message_name msg_name, float val) {
+void send_msg(Message_name msg_name, float val, int64_t timestamp_us) {
     Message msg_out;
 
     msg_out.name = msg_name;
+    msg_out.timestamp_us = timestamp_us;
     msg_out.value_float = val;
 
     send_msg(msg_out);
 }
-void send_msg(Message_name msg_name, int val) {
+void send_msg(Message_name msg_name, int val, int64_t timestamp_us) {
     Message msg_out;
 
     msg_out.name = msg_name;
+    msg_out.timestamp_us = timestamp_us;
     msg_out.value_int = val;
 
     send_msg(msg_out);
 }
-void send_msg(Message_name msg_name, Message_status val) {
+void send_msg(Message_name msg_name, Message_status val, int64_t timestamp_us) {
     Message msg_out;
 
     msg_out.name = msg_name;
+    msg_out.timestamp_us = timestamp_us;
     msg_out.value_status = val;
 
     send_msg(msg_out);
 }
+void send_msg(Message_name msg_name, const Gnss_fix &val, int64_t timestamp_us) {
+    Message msg_out;
+
+    msg_out.name = msg_name;
+    msg_out.timestamp_us = timestamp_us;
+    msg_out.value_gnss_fix = val;
+
+    send_msg(msg_out);
+}
+
+void send_msg(Message_name msg_name, const Command_request &val, int64_t timestamp_us) {
+    Message msg_out;
+
+    msg_out.name = msg_name;
+    msg_out.timestamp_us = timestamp_us;
+    msg_out.value_command_request = val;
+
+    send_msg(msg_out);
+}
+
+void send_msg(Message_name msg_name, const Command_event &val, int64_t timestamp_us) {
+    Message msg_out;
+
+    msg_out.name = msg_name;
+    msg_out.timestamp_us = timestamp_us;
+    msg_out.value_command_event = val;
+
+    send_msg(msg_out);
+}
+
+void send_msg(Message_name msg_name, const Cell_summary &val, int64_t timestamp_us) {
+    Message msg_out;
+
+    msg_out.name = msg_name;
+    msg_out.timestamp_us = timestamp_us;
+    msg_out.value_cell_summary = val;
+
+    send_msg(msg_out);
+}
 
 void send_msg(Message_name msg_name) {
     send_msg(msg_name, 0);
 }
+
+void debug_printf(const char *format, ...) {
+    if ( slcan_is_open() ) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+Debug_stream debug_serial;
+
+size_t Debug_stream::write(uint8_t c) {
+    return slcan_is_open() ? 1 : Serial.write(c);
+}
+
+size_t Debug_stream::write(const uint8_t *buf, size_t size) {
+    return slcan_is_open() ? size : Serial.write(buf, size);
+}
@@ -0,0 +1,169 @@
+#include <Arduino.h>
+
+#include "gnss_urc.h"
+
+#include <esp_timer.h>
+
+static const char prefix[] = GNSS_URC_PREFIX;
+static const uint8_t prefix_len = sizeof(prefix) - 1;
+
+// +UGNSINF: <run>,<fix>,<yyyyMMddhhmmss.sss>,<lat>,<lon>,<altitude m>,<speed km/h>,<course>,...
+enum Report_field {
+    field_run,
+    field_fix,
+    field_utc,
+    field_latitude,
+    field_longitude,
+    field_altitude,
+    field_speed,
+};
+
+static uint8_t two_digits(const char *s) {
+    return ( s[0] - '0' ) * 10 + ( s[1] - '0' );
+}
+
+int Gnss_urc_stream::available() {
+    poll();
+    return pass_count;
+}
+
+int Gnss_urc_stream::read() {
+    poll();
+    if ( pass_count == 0 ) {
+        return -1;
+    }
+
+    uint8_t c = pass_buffer[pass_head];
+    pass_head = ( pass_head + 1 ) % GNSS_URC_PASS_BUFFER;
+    pass_count--;
+    return c;
+}
+
+int Gnss_urc_stream::peek() {
+    poll();
+    return pass_count > 0 ? pass_buffer[pass_head] : -1;
+}
+
+void Gnss_urc_stream::poll() {
+    // Leave the bytes in the UART while TinyGSM has not read the previous ones (a failed prefix match passes them all)
+    while ( pass_count + prefix_len < GNSS_URC_PASS_BUFFER && io.available() > 0 ) {
+        int c = io.read();
+        if ( c < 0 ) {
+            break;
+        }
+        process(c);
+    }
+}
+
+bool Gnss_urc_stream::read_report(Gnss_report *report) {
+    if ( !fresh ) {
+        return false;
+    }
+
+    *report = latest;
+    fresh = false;
+    return true;
+}
+
+void Gnss_urc_stream::pass(char c) {
+    if ( pass_count < GNSS_URC_PASS_BUFFER ) {
+        pass_buffer[( pass_head + pass_count ) % GNSS_URC_PASS_BUFFER] = c;
+        pass_count++;
+    }
+}
+
+void Gnss_urc_stream::process(char c) {
+    if ( in_report ) {
+        if ( c == '\n' ) {
+            end_field();
+
+            if ( field_index > field_speed ) {
+                latest = pending;
+                fresh = true;
+                report_count++;
+            }
+
+            in_report = false;
+            line_start = true;
+        }
+        else if ( c == ',' ) {
+            end_field();
+        }
+        else if ( c != '\r' && !( c == ' ' && field_len == 0 ) && field_len < GNSS_URC_FIELD_SIZE - 1 ) {
+            field[field_len++] = c;
+        }
+        return;
+    }
+
+    // Only lines starting with the prefix are reports
+    if ( line_start ) {
+        if ( c == prefix[matched] ) {
+            if ( matched == 0 ) {
+                pending = {};
+                pending.timestamp_us = esp_timer_get_time();
+            }
+
+            if ( ++matched == prefix_len ) {
+                in_report = true;
+                matched = 0;
+                field_len = 0;
+                field_index = 0;
+            }
+            return;
+        }
+
+        for ( uint8_t i = 0; i < matched; i++ ) {
+            pass(prefix[i]);
+        }
+        matched = 0;
+    }
+
+    pass(c);
+    line_start = c == '\n';
+}
+
+void Gnss_urc_stream::end_field() {
+    field[field_len] = '\0';
+
+    switch ( field_index ) {
+        case field_fix:
+            pending.fix = field[0] == '1';
+            break;
+
+        case field_utc:
+            if ( field_len >= 14 ) {
+                pending.utc.year = two_digits(field + 2);
+                pending.utc.month = two_digits(field + 4);
+                pending.utc.day = two_digits(field + 6);
+                pending.utc.hours = two_digits(field + 8);
+                pending.utc.minutes = two_digits(field + 10);
+                pending.utc.seconds = two_digits(field + 12);
+                pending.utc_valid = true;
+            }
+            break;
+
+        case field_latitude:
+            pending.position.latitude = atof(field);
+            break;
+
+        case field_longitude:
+            pending.position.longitude = atof(field);
+            break;
+
+        case field_altitude:
+            pending.position.altitude = atof(field);
+            break;
+
+        case field_speed:
+            pending.position.speed = atof(field);
+            break;
+
+        default:
+            break;
+    }
+
+    if ( field_index < 255 ) {
+        field_index++;
+    }
+    field_len = 0;
+}
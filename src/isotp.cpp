@@ -0,0 +1,146 @@
+#include <Arduino.h>
+#include <driver/can.h>
+
+#include "config.h"
+#include "can_bus.h"
+#include "isotp.h"
+
+#include <esp_timer.h>
+
+#define PCI_SINGLE 0x0
+#define PCI_FIRST 0x1
+#define PCI_CONSECUTIVE 0x2
+#define PCI_FLOW_CONTROL 0x3
+
+
+static bool send_frame(Isotp_channel *ch, const uint8_t *data, uint8_t len) {
+    can_message_t msg = {};
+    msg.identifier = ch->tx_id;
+    msg.flags = CAN_MSG_FLAG_NONE;
+    msg.data_length_code = 8;
+
+    // Unused bytes are padded
+    memset(msg.data, 0xFF, 8);
+    memcpy(msg.data, data, len);
+
+    return can_bus_transmit(&msg, 0) == ESP_OK;
+}
+
+void isotp_init(Isotp_channel *ch, uint32_t tx_id, uint32_t rx_id) {
+    ch->tx_id = tx_id;
+    ch->rx_id = rx_id;
+    ch->state = isotp_idle;
+    ch->len = 0;
+    ch->received = 0;
+}
+
+bool isotp_request(Isotp_channel *ch, const uint8_t *data, uint8_t len) {
+    if ( len > 7 ) {
+        return false;
+    }
+
+    uint8_t frame[8];
+    frame[0] = ( PCI_SINGLE << 4 ) | len;
+    memcpy(frame + 1, data, len);
+
+    if ( !send_frame(ch, frame, len + 1) ) {
+        ch->state = isotp_error;
+        return false;
+    }
+
+    ch->state = isotp_waiting;
+    ch->len = 0;
+    ch->received = 0;
+    ch->deadline_us = esp_timer_get_time() + ISOTP_TIMEOUT_MS * 1000LL;
+
+    return true;
+}
+
+void isotp_frame(Isotp_channel *ch, const can_message_t &frame, int64_t now_us) {
+    if ( frame.identifier != ch->rx_id || frame.data_length_code < 1 ) {
+        return;
+    }
+
+    const uint8_t *data = frame.data;
+    uint8_t pci = data[0] >> 4;
+
+    switch ( pci ) {
+        case PCI_SINGLE: {
+            uint8_t len = data[0] & 0x0F;
+            if ( ch->state != isotp_waiting || len == 0 || len > 7 || len >= frame.data_length_code ) {
+                return;
+            }
+
+            memcpy(ch->buffer, data + 1, len);
+            ch->len = len;
+            ch->received = len;
+            ch->state = isotp_done;
+            break;
+        }
+
+        case PCI_FIRST: {
+            uint16_t len = ( ( data[0] & 0x0F ) << 8 ) | data[1];
+            if ( ch->state != isotp_waiting || frame.data_length_code < 8 ) {
+                return;
+            }
+            if ( len > ISOTP_MAX_LEN || len < 8 ) {
+                ch->state = isotp_error;
+                return;
+            }
+
+            memcpy(ch->buffer, data + 2, 6);
+            ch->len = len;
+            ch->received = 6;
+            ch->next_sn = 1;
+
+            // Clear to send all the consecutive frames, without separation time
+            const uint8_t flow_control[3] = { PCI_FLOW_CONTROL << 4, 0x00, ISOTP_STMIN_MS };
+            if ( !send_frame(ch, flow_control, 3) ) {
+                ch->state = isotp_error;
+                return;
+            }
+
+            ch->state = isotp_receiving;
+            ch->deadline_us = now_us + ISOTP_TIMEOUT_MS * 1000LL;
+            break;
+        }
+
+        case PCI_CONSECUTIVE: {
+            if ( ch->state != isotp_receiving ) {
+                return;
+            }
+            if ( ( data[0] & 0x0F ) != ch->next_sn ) {
+                ch->state = isotp_error;
+                return;
+            }
+
+            uint16_t n = ch->len - ch->received;
+            if ( n > 7 ) {
+                n = 7;
+            }
+            if ( n >= frame.data_length_code ) {
+                ch->state = isotp_error;
+                return;
+            }
+
+            memcpy(ch->buffer + ch->received, data + 1, n);
+            ch->received += n;
+            ch->next_sn = ( ch->next_sn + 1 ) & 0x0F;
+            ch->deadline_us = now_us + ISOTP_TIMEOUT_MS * 1000LL;
+
+            if ( ch->received == ch->len ) {
+                ch->state = isotp_done;
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+void isotp_tick(Isotp_channel *ch, int64_t now_us) {
+    if ( ( ch->state == isotp_waiting || ch->state == isotp_receiving ) && now_us > ch->deadline_us ) {
+        ch->state = isotp_error;
+    }
+}
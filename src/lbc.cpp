@@ -0,0 +1,215 @@
+#include <Arduino.h>
+#include <atomic>
+
+#include "globals.h"
+#include "config.h"
+#include "functions.h"
+#include "can_signals.h"
+#include "isotp.h"
+#include "lbc.h"
+
+#include <esp_timer.h>
+
+// Some message # etc. taken from here: https://github.com/openvehicles/Open-Vehicle-Monitoring-System-3/blob/master/vehicle/OVMS.V3/components/vehicle_nissanleaf/src/vehicle_nissanleaf.cpp
+
+#define LBC_SERVICE 0x21            // Read data by local identifier
+#define LBC_POSITIVE_RESPONSE 0x61
+
+typedef void (*Lbc_handler)(const uint8_t *data, uint16_t len, int64_t timestamp_us);
+
+struct Lbc_poll {
+    uint8_t group;
+    uint16_t interval_s;
+    Lbc_handler handle;             // Called with the response data after the service and group bytes
+};
+
+static void handle_cells(const uint8_t *data, uint16_t len, int64_t timestamp_us);
+static void handle_temperatures(const uint8_t *data, uint16_t len, int64_t timestamp_us);
+
+static const Lbc_poll polls[] = {
+    { 0x02, LBC_CELLS_INTERVAL_S, handle_cells },
+    { 0x04, LBC_TEMPERATURES_INTERVAL_S, handle_temperatures },
+};
+
+static constexpr int n_polls = sizeof(polls) / sizeof(polls[0]);
+
+static int64_t next_poll_us[n_polls] = {};
+static int current_poll = -1;      // Poll waiting for its response
+
+static Isotp_channel channel;
+static bool channel_ready = false;
+
+// Seqlock protected snapshot, same scheme as telemetry.cpp (single writer: leafcan_task)
+static Battery_cells cells;
+static std::atomic<uint32_t> sequence(0);
+
+
+static void write_begin() {
+    sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+static void write_end() {
+    sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void lbc_read(Battery_cells *snapshot) {
+    uint32_t seq_before;
+    uint32_t seq_after;
+
+    do {
+        seq_before = sequence.load(std::memory_order_acquire);
+
+        // A write is in progress
+        if ( seq_before & 1 ) {
+            continue;
+        }
+
+        memcpy(snapshot, &cells, sizeof(Battery_cells));
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        seq_after = sequence.load(std::memory_order_relaxed);
+    } while ( ( seq_before & 1 ) || seq_before != seq_after );
+}
+
+int lbc_format_json(const Battery_cells &snapshot, char *buf, size_t size) {
+    int n = snprintf(buf, size, "{\"mv\":");
+
+    for ( int i = 0; i < LBC_CELL_COUNT && n < (int)size; i++ ) {
+        n += snprintf(buf + n, size - n, "%s%u", i == 0 ? "[" : ",", snapshot.voltages_mv[i]);
+    }
+
+    if ( n < (int)size ) {
+        n += snprintf(buf + n, size - n, "]");
+    }
+
+    // Temperatures once polled
+    for ( int i = 0; i < LBC_TEMPERATURE_SENSORS && snapshot.temperatures_timestamp_us != 0 && n < (int)size; i++ ) {
+        n += snprintf(buf + n, size - n, "%s%d", i == 0 ? ",\"temp\":[" : ",", snapshot.temperatures_c[i]);
+    }
+    if ( snapshot.temperatures_timestamp_us != 0 && n < (int)size ) {
+        n += snprintf(buf + n, size - n, "]");
+    }
+
+    if ( n < (int)size ) {
+        n += snprintf(buf + n, size - n, "}");
+    }
+
+    return n;
+}
+
+// 96 cell voltages, 2 bytes each (mV, big endian)
+static void handle_cells(const uint8_t *data, uint16_t len, int64_t timestamp_us) {
+    if ( len < LBC_CELL_COUNT * 2 ) {
+        return;
+    }
+
+    Cell_summary summary = { 0xFFFF, 0, 0, 0, 0 };
+    uint32_t sum = 0;
+
+    write_begin();
+    for ( int i = 0; i < LBC_CELL_COUNT; i++ ) {
+        uint16_t mv = ( data[2 * i] << 8 ) | data[2 * i + 1];
+        cells.voltages_mv[i] = mv;
+
+        sum += mv;
+        if ( mv < summary.min_mv ) {
+            summary.min_mv = mv;
+            summary.min_cell = i;
+        }
+        if ( mv > summary.max_mv ) {
+            summary.max_mv = mv;
+            summary.max_cell = i;
+        }
+    }
+    cells.voltages_timestamp_us = timestamp_us;
+    write_end();
+
+    summary.avg_mv = sum / LBC_CELL_COUNT;
+
+    // All the cells in one message, the individual voltages are read from the snapshot
+    send_msg(Message_name::cell_voltages, summary, timestamp_us);
+}
+
+// Per sensor: 2 bytes thermistor reading, 1 byte temperature (degC, signed)
+static void handle_temperatures(const uint8_t *data, uint16_t len, int64_t timestamp_us) {
+    if ( len < LBC_TEMPERATURE_SENSORS * 3 ) {
+        return;
+    }
+
+    int8_t max_c = INT8_MIN;
+
+    write_begin();
+    for ( int i = 0; i < LBC_TEMPERATURE_SENSORS; i++ ) {
+        int8_t c = (int8_t)data[3 * i + 2];
+        cells.temperatures_c[i] = c;
+
+        if ( c > max_c ) {
+            max_c = c;
+        }
+    }
+    cells.temperatures_timestamp_us = timestamp_us;
+    write_end();
+
+    send_msg(Message_name::battery_temperature, (float)max_c, timestamp_us);
+}
+
+void lbc_frame(const Can_frame &frame) {
+    if ( LBC_POLLING && channel_ready ) {
+        isotp_frame(&channel, frame.msg, frame.timestamp_us);
+    }
+}
+
+void lbc_tick() {
+    if ( !LBC_POLLING ) {
+        return;
+    }
+
+    if ( !channel_ready ) {
+        isotp_init(&channel, CAN_ID_LBC_REQUEST, CAN_ID_LBC_RESPONSE);
+        channel_ready = true;
+    }
+
+    int64_t now = esp_timer_get_time();
+    isotp_tick(&channel, now);
+
+    // Response complete (or failed): hand it over, the poll is due again after its interval either way
+    if ( current_poll >= 0 && ( channel.state == isotp_done || channel.state == isotp_error ) ) {
+        const Lbc_poll &poll = polls[current_poll];
+
+        if ( channel.state == isotp_done && channel.len >= 2
+                && channel.buffer[0] == LBC_POSITIVE_RESPONSE && channel.buffer[1] == poll.group ) {
+            poll.handle(channel.buffer + 2, channel.len - 2, now);
+        }
+
+        next_poll_us[current_poll] = now + poll.interval_s * 1000000LL;
+        channel.state = isotp_idle;
+        current_poll = -1;
+    }
+
+    if ( current_poll >= 0 ) {
+        return;
+    }
+
+    // The LBC only answers while the car is on or charging (battery power is broadcast at 100Hz)
+    int64_t last_seen = can_last_seen_us(CAN_ID_BATTERY_POWER);
+    if ( last_seen == 0 || now - last_seen > 1000000 ) {
+        return;
+    }
+
+    // One request at a time, the broadcast frames keep being decoded meanwhile
+    for ( int i = 0; i < n_polls; i++ ) {
+        if ( now >= next_poll_us[i] ) {
+            const uint8_t request[2] = { LBC_SERVICE, polls[i].group };
+
+            if ( isotp_request(&channel, request, 2) ) {
+                current_poll = i;
+            }
+            else {
+                channel.state = isotp_idle;
+                next_poll_us[i] = now + polls[i].interval_s * 1000000LL;
+            }
+            return;
+        }
+    }
+}
@@ -4,18 +4,26 @@
 #include "globals.h"
 #include "config.h"
 
+#include "msg_bus.h"
 #include "msg_forwarder.h"
+#include "can_bus.h"
+#include "can_tx.h"
+#include "slcan.h"
 // #include "display.h"
 #include "leafCAN.h"
 #include "sdcard_logger.h"
 #include "comm_gnss.h"
 #include "pressure.h"
 
-QueueHandle_t q_out = xQueueCreate(50, sizeof(Message));
-QueueHandle_t q_leafcan = xQueueCreate(50, sizeof(Message));
-QueueHandle_t q_display = xQueueCreate(50, sizeof(Message));
-QueueHandle_t q_logger = xQueueCreate(50, sizeof(Message));
-QueueHandle_t q_comm_gnss = xQueueCreate(50, sizeof(Message));
+#if MSG_FORWARDER_TASK
+QueueHandle_t q_out = xQueueCreate(MSG_QUEUE_LENGTH, sizeof(Message));
+#else
+QueueHandle_t q_out = NULL;
+#endif
+QueueHandle_t q_leafcan = xQueueCreate(MSG_QUEUE_LENGTH, sizeof(Message));
+QueueHandle_t q_display = xQueueCreate(MSG_QUEUE_LENGTH, sizeof(Message));
+QueueHandle_t q_logger = xQueueCreate(MSG_QUEUE_LENGTH, sizeof(Message));
+QueueHandle_t q_comm_gnss = xQueueCreate(MSG_QUEUE_LENGTH, sizeof(Message));
 
 float some_test_value = 0;
 
@@ -37,9 +45,22 @@ void setup() {
     Serial.begin( SERIAL_BAUDRATE );
     Serial.setDebugOutput( ENABLE_SERIAL_DEBUG );
 
+    // Message routing
+#if MSG_FORWARDER_TASK
+    msg_register_forwarder( msg_queue_register("out", q_out, MSG_QUEUE_LENGTH, Q_OUT_POLICY) );
+#endif
+    msg_register_sink( Message_sink::sink_display, msg_queue_register("display", q_display, MSG_QUEUE_LENGTH, Q_DISPLAY_POLICY) );
+    msg_register_sink( Message_sink::sink_leafcan, msg_queue_register("leafcan", q_leafcan, MSG_QUEUE_LENGTH, Q_LEAFCAN_POLICY) );
+    msg_register_sink( Message_sink::sink_logger, msg_queue_register("logger", q_logger, MSG_QUEUE_LENGTH, Q_LOGGER_POLICY) );
+    msg_register_sink( Message_sink::sink_comm_gnss, msg_queue_register("comm_gnss", q_comm_gnss, MSG_QUEUE_LENGTH, Q_COMM_GNSS_POLICY) );
+
+#if MSG_FORWARDER_TASK
     xTaskCreatePinnedToCore( msg_forwarder_task, "msg_forwarder_task", 4096, NULL, 5, NULL, 1);  // high watermark 2304
+#endif
     // xTaskCreatePinnedToCore( display_task, "display_task", 4096, NULL, 5, NULL, 1);  // high watermark 1048
     xTaskCreatePinnedToCore( leafcan_task, "leafcan_task", 4096, NULL, 5, NULL, 1); // high watermark 2220
+    xTaskCreatePinnedToCore( can_tx_task, "can_tx_task", 4096, NULL, CAN_TX_TASK_PRIORITY, NULL, 1);
+    xTaskCreatePinnedToCore( slcan_task, "slcan_task", 4096, NULL, 3, NULL, 1);
     xTaskCreatePinnedToCore( logger_task, "logger_task", 4096, NULL, 5, NULL, 1);  // high watermark 2328
     xTaskCreatePinnedToCore( comm_gnss_task, "comm_gnss_task", 4096, NULL, 4, NULL, 1); // high watermark 1736
     xTaskCreatePinnedToCore( pressure_task, "pressure_task", 4096, NULL, 5, NULL, 1);  // high watermark 2448
@@ -47,4 +68,13 @@ void setup() {
 
 void loop() {
     delay(1000);
+
+#if DIAG_PRINT_INTERVAL_S > 0
+    static int seconds = 0;
+    if ( ++seconds >= DIAG_PRINT_INTERVAL_S ) {
+        seconds = 0;
+        msg_print_stats();
+        can_bus_print_stats();
+    }
+#endif
 }
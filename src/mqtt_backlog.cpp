@@ -0,0 +1,274 @@
+#include <Arduino.h>
+#include <FS.h>
+
+#include "config.h"
+#include "mqtt_backlog.h"
+
+#define BACKLOG_PATH "/backlog.bin"
+
+static_assert(sizeof(Backlog_record) == BACKLOG_RECORD_SIZE, "Backlog_record size");
+
+static portMUX_TYPE backlog_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Newest records, queued by comm_gnss_task
+static Backlog_record ram[BACKLOG_RAM_SLOTS];
+static uint32_t ram_head = 0;
+static uint32_t ram_count = 0;
+
+// Oldest records, read back from the SD-card. Only written by logger_task while empty.
+static Backlog_record batch[BACKLOG_DRAIN_BATCH];
+static uint32_t batch_head = 0;
+static uint32_t batch_count = 0;
+
+static uint32_t sd_count = 0;
+static bool sd_known = false;       // The file header has been read (or there is no card)
+static volatile bool online = false;
+static uint32_t boot = 0;
+static uint32_t next_seq = 0;
+
+static Backlog_stats counters = {};
+
+
+void backlog_push(const char *topic, const char *payload, int64_t timestamp_us) {
+    portENTER_CRITICAL(&backlog_mux);
+
+    // Evict the oldest record when full (logger_task spills the ring to the SD-card well before that)
+    if ( ram_count == BACKLOG_RAM_SLOTS ) {
+        ram_head = ( ram_head + 1 ) % BACKLOG_RAM_SLOTS;
+        ram_count--;
+        counters.evicted++;
+    }
+
+    Backlog_record &record = ram[( ram_head + ram_count ) % BACKLOG_RAM_SLOTS];
+    record.timestamp_us = timestamp_us;
+    record.seq = next_seq++;
+    record.boot = boot;
+    strncpy(record.topic, topic, sizeof(record.topic) - 1);
+    record.topic[sizeof(record.topic) - 1] = '\0';
+    strncpy(record.payload, payload, sizeof(record.payload) - 1);
+    record.payload[sizeof(record.payload) - 1] = '\0';
+
+    ram_count++;
+    counters.stored++;
+
+    portEXIT_CRITICAL(&backlog_mux);
+}
+
+void backlog_set_online(bool is_online) {
+    online = is_online;
+}
+
+bool backlog_front(Backlog_record *record) {
+    bool found = true;
+
+    portENTER_CRITICAL(&backlog_mux);
+
+    if ( batch_count > 0 ) {
+        *record = batch[batch_head];
+    }
+    else if ( sd_count > 0 || ram_count == 0 ) {
+        // Older records are still on the SD-card
+        found = false;
+    }
+    else {
+        *record = ram[ram_head];
+    }
+
+    portEXIT_CRITICAL(&backlog_mux);
+
+    return found;
+}
+
+void backlog_pop(uint32_t seq) {
+    portENTER_CRITICAL(&backlog_mux);
+
+    if ( batch_count > 0 ) {
+        if ( batch[batch_head].seq == seq ) {
+            batch_head++;
+            batch_count--;
+            counters.sent++;
+        }
+    }
+    else if ( ram_count > 0 && ram[ram_head].seq == seq ) {
+        ram_head = ( ram_head + 1 ) % BACKLOG_RAM_SLOTS;
+        ram_count--;
+        counters.sent++;
+    }
+
+    portEXIT_CRITICAL(&backlog_mux);
+}
+
+uint32_t backlog_boot() {
+    return boot;
+}
+
+bool backlog_sd_pending() {
+    portENTER_CRITICAL(&backlog_mux);
+
+    bool pending = !sd_known
+        || ( !online && ram_count >= BACKLOG_SPILL_THRESHOLD )
+        || ( online && batch_count == 0 && sd_count > 0 );
+
+    portEXIT_CRITICAL(&backlog_mux);
+
+    return pending;
+}
+
+static bool write_header(File &file, const Backlog_file_header &header) {
+    return file.seek(0) && file.write((const uint8_t *)&header, sizeof(header)) == sizeof(header);
+}
+
+static bool slot_seek(File &file, uint32_t slot) {
+    return file.seek(sizeof(Backlog_file_header) + slot * sizeof(Backlog_record));
+}
+
+// Open the ring file, creating it if it is missing or was made with another configuration
+static File open_ring(fs::FS &fs, Backlog_file_header *header) {
+    File file = fs.open(BACKLOG_PATH, "r+");
+
+    bool valid = file
+        && file.read((uint8_t *)header, sizeof(*header)) == sizeof(*header)
+        && header->magic == BACKLOG_MAGIC
+        && header->version == BACKLOG_VERSION
+        && header->record_size == sizeof(Backlog_record)
+        && header->slots == BACKLOG_SD_SLOTS
+        && header->head < header->slots
+        && header->count <= header->slots;
+
+    if ( valid ) {
+        return file;
+    }
+
+    file.close();
+
+    *header = {};
+    header->magic = BACKLOG_MAGIC;
+    header->version = BACKLOG_VERSION;
+    header->record_size = sizeof(Backlog_record);
+    header->slots = BACKLOG_SD_SLOTS;
+
+    file = fs.open(BACKLOG_PATH, FILE_WRITE);
+    if ( file && !write_header(file, *header) ) {
+        file.close();
+    }
+
+    return file;
+}
+
+void backlog_sd_sync(fs::FS *fs) {
+    Backlog_file_header header;
+    File file;
+
+    if ( fs != NULL ) {
+        file = open_ring(*fs, &header);
+    }
+
+    if ( !file ) {
+        // No card: the RAM ring evicts its oldest records when full. Records already on the card stay counted,
+        // the mount may only have failed this time.
+        portENTER_CRITICAL(&backlog_mux);
+        sd_known = true;
+        portEXIT_CRITICAL(&backlog_mux);
+        return;
+    }
+
+    portENTER_CRITICAL(&backlog_mux);
+    if ( !sd_known ) {
+        header.boots++;
+        boot = header.boots;
+    }
+    sd_count = header.count;
+    portEXIT_CRITICAL(&backlog_mux);
+
+    // Spill the whole RAM ring, oldest first, overwriting the oldest records of the file when it is full.
+    // A record leaving the RAM ring is counted on the SD-card at once, so that backlog_front() does not serve
+    // newer RAM records before it if the connection comes back meanwhile.
+    Backlog_record record;
+
+    while ( !online ) {
+        portENTER_CRITICAL(&backlog_mux);
+        bool have_record = ram_count > 0;
+        if ( have_record ) {
+            record = ram[ram_head];
+            ram_head = ( ram_head + 1 ) % BACKLOG_RAM_SLOTS;
+            ram_count--;
+            sd_count++;
+        }
+        portEXIT_CRITICAL(&backlog_mux);
+
+        if ( !have_record ) {
+            break;
+        }
+
+        uint32_t slot = ( header.head + header.count ) % header.slots;
+
+        if ( !slot_seek(file, slot) || file.write((const uint8_t *)&record, sizeof(record)) != sizeof(record) ) {
+            portENTER_CRITICAL(&backlog_mux);
+            sd_count--;
+            counters.evicted++;
+            portEXIT_CRITICAL(&backlog_mux);
+            continue;
+        }
+
+        portENTER_CRITICAL(&backlog_mux);
+        if ( header.count == header.slots ) {
+            header.head = ( header.head + 1 ) % header.slots;
+            sd_count--;
+            counters.evicted++;
+        }
+        else {
+            header.count++;
+        }
+        counters.spilled++;
+        portEXIT_CRITICAL(&backlog_mux);
+    }
+
+    // Read back the next batch. The batch is empty, so comm_gnss_task does not touch it.
+    uint32_t n = 0;
+
+    if ( online && batch_count == 0 ) {
+        while ( n < BACKLOG_DRAIN_BATCH && header.count > 0 ) {
+            if ( !slot_seek(file, header.head) || file.read((uint8_t *)&batch[n], sizeof(Backlog_record)) != sizeof(Backlog_record) ) {
+                // Unreadable file: drop the rest rather than blocking the records queued in RAM
+                portENTER_CRITICAL(&backlog_mux);
+                counters.evicted += header.count;
+                portEXIT_CRITICAL(&backlog_mux);
+                header.count = 0;
+                break;
+            }
+
+            header.head = ( header.head + 1 ) % header.slots;
+            header.count--;
+            n++;
+        }
+    }
+
+    write_header(file, header);
+    file.close();
+
+    portENTER_CRITICAL(&backlog_mux);
+    if ( n > 0 ) {
+        batch_head = 0;
+        batch_count = n;
+    }
+    sd_count = header.count;
+    sd_known = true;
+    portEXIT_CRITICAL(&backlog_mux);
+}
+
+void backlog_stats(Backlog_stats *stats) {
+    portENTER_CRITICAL(&backlog_mux);
+    *stats = counters;
+    stats->ram = ram_count + batch_count;
+    stats->sd = sd_count;
+    portEXIT_CRITICAL(&backlog_mux);
+}
+
+int backlog_format_stats(char *buf, size_t size) {
+    Backlog_stats stats;
+    backlog_stats(&stats);
+
+    return snprintf(buf, size, "{\"ram\":%u,\"sd\":%u,\"stored\":%u,\"spilled\":%u,\"sent\":%u,\"evicted\":%u}",
+        (unsigned)stats.ram, (unsigned)stats.sd, (unsigned)stats.stored,
+        (unsigned)stats.spilled, (unsigned)stats.sent, (unsigned)stats.evicted);
+}
@@ -0,0 +1,290 @@
+#include <Arduino.h>
+
+#include "globals.h"
+#include "config.h"
+#include "functions.h"
+#include "mqtt_commands.h"
+#include "wall_clock.h"
+
+#define COMMAND_ID_SIZE 24
+#define COMMAND_RESPONSE_SIZE 256
+
+struct Mqtt_command {
+    const char *name;
+    Message_name request;
+    Message_status status;
+    bool can_job;               // Sent on the CAN bus, a command_event reports the outcome
+};
+
+static const Mqtt_command commands[] = {
+    { "poll",           Message_name::update_request,   Message_status::no_status,              false },
+    { "start_ac",       Message_name::ac_request,       Message_status::request_ac_start,       true },
+    { "stop_ac",        Message_name::ac_request,       Message_status::request_ac_stop,        true },
+    { "start_charge",   Message_name::charge_request,   Message_status::request_charge_start,   true },
+    { "lock_doors",     Message_name::doors_request,    Message_status::request_doors_lock,     true },
+    { "unlock_doors",   Message_name::doors_request,    Message_status::request_doors_unlock,   true },
+    { "toggle_slcan",   Message_name::toggle_slcan,     Message_status::no_status,              false },
+    { "start_capture",  Message_name::capture_request,  Message_status::request_capture_start,  false },
+    { "stop_capture",   Message_name::capture_request,  Message_status::request_capture_stop,   false },
+};
+
+static constexpr int n_commands = sizeof(commands) / sizeof(commands[0]);
+
+// Commands waiting for their command_event
+struct Pending_command {
+    uint16_t command_id;        // 0: free
+    uint8_t command;            // Index in commands[]
+    char id[COMMAND_ID_SIZE];
+    int64_t received_us;
+};
+
+static Pending_command pending[MQTT_COMMAND_PENDING] = {};
+static uint16_t next_command_id = 1;
+
+// Responses waiting to be published, the oldest is dropped when full
+static char outbox[MQTT_COMMAND_OUTBOX][COMMAND_RESPONSE_SIZE];
+static int outbox_head = 0;
+static int outbox_count = 0;
+
+// Latency histograms: bucket i counts the latencies up to latency_bounds_ms[i], the last one those above
+static const uint16_t latency_bounds_ms[] = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000 };
+static constexpr int n_buckets = sizeof(latency_bounds_ms) / sizeof(latency_bounds_ms[0]) + 1;
+
+struct Command_stats {
+    uint32_t received;
+    uint32_t unknown;
+    uint32_t invalid;
+    uint32_t sent;
+    uint32_t confirmed;
+    uint32_t timeout;
+    uint32_t cancelled;
+    uint32_t failed;
+    uint32_t transmit[n_buckets];   // From the receipt to the first frame
+    uint32_t confirm[n_buckets];    // From the receipt to the confirmation
+};
+
+static Command_stats stats = {};
+
+
+static void histogram_add(uint32_t *buckets, uint32_t latency_us) {
+    int i = 0;
+    while ( i < n_buckets - 1 && latency_us > latency_bounds_ms[i] * 1000UL ) {
+        i++;
+    }
+    buckets[i]++;
+}
+
+static int format_histogram(const uint32_t *buckets, char *buf, size_t size) {
+    int n = 0;
+    for ( int i = 0; i < n_buckets && n < (int)size; i++ ) {
+        n += snprintf(buf + n, size - n, "%s%u", i == 0 ? "[" : ",", (unsigned)buckets[i]);
+    }
+    if ( n < (int)size ) {
+        n += snprintf(buf + n, size - n, "]");
+    }
+    return n;
+}
+
+// command: NULL for unknown commands, which are not echoed. event: final responses only.
+static void queue_response(const char *command, const char *id, const char *status, int64_t received_us, const Command_event *event) {
+    if ( outbox_count == MQTT_COMMAND_OUTBOX ) {
+        outbox_head = ( outbox_head + 1 ) % MQTT_COMMAND_OUTBOX;
+        outbox_count--;
+    }
+
+    char *buf = outbox[( outbox_head + outbox_count ) % MQTT_COMMAND_OUTBOX];
+    size_t size = COMMAND_RESPONSE_SIZE;
+    outbox_count++;
+
+    int n = snprintf(buf, size, "{");
+    if ( command != NULL ) {
+        n += snprintf(buf + n, size - n, "\"command\":\"%s\",", command);
+    }
+    if ( id[0] != '\0' ) {
+        n += snprintf(buf + n, size - n, "\"id\":\"%s\",", id);
+    }
+    n += snprintf(buf + n, size - n, "\"status\":\"%s\"", status);
+
+    if ( event != NULL ) {
+        n += snprintf(buf + n, size - n, ",\"frames\":%u", event->frames_sent);
+    }
+
+    if ( clock_valid() ) {
+        n += snprintf(buf + n, size - n, ",\"received\":%lld", (long long)( clock_epoch_us(received_us) / 1000 ));
+
+        if ( event != NULL && event->sent_after_us != 0 ) {
+            n += snprintf(buf + n, size - n, ",\"sent\":%lld", (long long)( clock_epoch_us(received_us + event->sent_after_us) / 1000 ));
+        }
+        if ( event != NULL && event->confirmed_after_us != 0 ) {
+            n += snprintf(buf + n, size - n, ",\"confirmed\":%lld", (long long)( clock_epoch_us(received_us + event->confirmed_after_us) / 1000 ));
+        }
+    }
+
+    if ( event != NULL && event->sent_after_us != 0 ) {
+        n += snprintf(buf + n, size - n, ",\"transmit_ms\":%.1f", event->sent_after_us / 1000.0);
+    }
+    if ( event != NULL && event->confirmed_after_us != 0 ) {
+        n += snprintf(buf + n, size - n, ",\"confirm_ms\":%.1f", event->confirmed_after_us / 1000.0);
+    }
+
+    snprintf(buf + n, size - n, "}");
+}
+
+static bool valid_id_char(uint8_t c) {
+    return isalnum(c) || c == '-' || c == '_' || c == '.' || c == ':';
+}
+
+void command_received(const uint8_t *payload, unsigned int len, int64_t received_us) {
+    stats.received++;
+
+    // Trailing line end (mosquitto_pub -l, terminals)
+    while ( len > 0 && ( payload[len - 1] == '\n' || payload[len - 1] == '\r' || payload[len - 1] == ' ' ) ) {
+        len--;
+    }
+
+    unsigned int name_len = 0;
+    while ( name_len < len && payload[name_len] != ' ' ) {
+        name_len++;
+    }
+
+    // Optional id, after one space
+    char id[COMMAND_ID_SIZE] = "";
+    bool valid = true;
+
+    if ( name_len < len ) {
+        const uint8_t *arg = payload + name_len + 1;
+        unsigned int arg_len = len - name_len - 1;
+
+        valid = arg_len > 0 && arg_len < sizeof(id);
+        for ( unsigned int i = 0; i < arg_len && valid; i++ ) {
+            valid = valid_id_char(arg[i]);
+        }
+
+        if ( valid ) {
+            memcpy(id, arg, arg_len);
+            id[arg_len] = '\0';
+        }
+    }
+
+    int command = -1;
+    for ( int i = 0; i < n_commands; i++ ) {
+        if ( strlen(commands[i].name) == name_len && memcmp(commands[i].name, payload, name_len) == 0 ) {
+            command = i;
+            break;
+        }
+    }
+
+    if ( command < 0 ) {
+        stats.unknown++;
+        queue_response(NULL, id, "unknown", received_us, NULL);
+        return;
+    }
+
+    if ( !valid ) {
+        stats.invalid++;
+        queue_response(commands[command].name, id, "invalid", received_us, NULL);
+        return;
+    }
+
+    const Mqtt_command &c = commands[command];
+    Command_request request = { c.status, 0 };
+
+    if ( c.can_job ) {
+        // A free slot, or the oldest one (its command_event was lost)
+        Pending_command *slot = &pending[0];
+        for ( int i = 0; i < MQTT_COMMAND_PENDING; i++ ) {
+            if ( pending[i].command_id == 0 ) {
+                slot = &pending[i];
+                break;
+            }
+            if ( pending[i].received_us < slot->received_us ) {
+                slot = &pending[i];
+            }
+        }
+
+        slot->command_id = next_command_id++;
+        if ( next_command_id == 0 ) {
+            next_command_id = 1;
+        }
+        slot->command = command;
+        strcpy(slot->id, id);
+        slot->received_us = received_us;
+
+        request.command_id = slot->command_id;
+    }
+
+    send_msg(c.request, request, received_us);
+    queue_response(c.name, id, "accepted", received_us, NULL);
+}
+
+void command_finished(const Command_event &event) {
+    if ( event.command_id == 0 ) {
+        return;
+    }
+
+    for ( int i = 0; i < MQTT_COMMAND_PENDING; i++ ) {
+        Pending_command &p = pending[i];
+        if ( p.command_id != event.command_id ) {
+            continue;
+        }
+
+        const char *status;
+        switch ( event.result ) {
+            case Message_status::command_sent:      status = "sent";        stats.sent++;       break;
+            case Message_status::command_confirmed: status = "confirmed";   stats.confirmed++;  break;
+            case Message_status::command_timeout:   status = "timeout";     stats.timeout++;    break;
+            case Message_status::command_cancelled: status = "cancelled";   stats.cancelled++;  break;
+            default:                                status = "failed";      stats.failed++;     break;
+        }
+
+        if ( event.sent_after_us != 0 ) {
+            histogram_add(stats.transmit, event.sent_after_us);
+        }
+        if ( event.confirmed_after_us != 0 ) {
+            histogram_add(stats.confirm, event.confirmed_after_us);
+        }
+
+        queue_response(commands[p.command].name, p.id, status, p.received_us, &event);
+        p.command_id = 0;
+        return;
+    }
+}
+
+bool command_next_response(char *buf, size_t size) {
+    if ( outbox_count == 0 ) {
+        return false;
+    }
+
+    strncpy(buf, outbox[outbox_head], size - 1);
+    buf[size - 1] = '\0';
+    outbox_head = ( outbox_head + 1 ) % MQTT_COMMAND_OUTBOX;
+    outbox_count--;
+    return true;
+}
+
+int command_format_stats(char *buf, size_t size) {
+    int n = snprintf(buf, size, "{\"received\":%u,\"unknown\":%u,\"invalid\":%u,\"sent\":%u,\"confirmed\":%u,\"timeout\":%u,\"cancelled\":%u,\"failed\":%u,\"bounds_ms\":",
+        (unsigned)stats.received, (unsigned)stats.unknown, (unsigned)stats.invalid, (unsigned)stats.sent,
+        (unsigned)stats.confirmed, (unsigned)stats.timeout, (unsigned)stats.cancelled, (unsigned)stats.failed);
+
+    for ( int i = 0; i < n_buckets - 1 && n < (int)size; i++ ) {
+        n += snprintf(buf + n, size - n, "%s%u", i == 0 ? "[" : ",", latency_bounds_ms[i]);
+    }
+    if ( n < (int)size ) {
+        n += snprintf(buf + n, size - n, "],\"transmit\":");
+    }
+    if ( n < (int)size ) {
+        n += format_histogram(stats.transmit, buf + n, size - n);
+    }
+    if ( n < (int)size ) {
+        n += snprintf(buf + n, size - n, ",\"confirm\":");
+    }
+    if ( n < (int)size ) {
+        n += format_histogram(stats.confirm, buf + n, size - n);
+    }
+    if ( n < (int)size ) {
+        n += snprintf(buf + n, size - n, "}");
+    }
+
+    return n;
+}
@@ -0,0 +1,134 @@
+#include <Arduino.h>
+#include <math.h>
+
+#include "globals.h"
+#include "config.h"
+#include "mqtt_schedule.h"
+#include "wall_clock.h"
+
+struct Mqtt_topic {
+    const char *name;
+    float (*read)(const Publish_inputs &inputs);    // NAN if not available
+    uint8_t decimals;
+    Publish_policy policy;
+};
+
+static float telemetry_float(const Publish_inputs &inputs, Message_name name) {
+    const Message &msg = inputs.telemetry->values[name];
+    return msg.name == name ? msg.value_float : NAN;
+}
+
+static float telemetry_status(const Publish_inputs &inputs, Message_name name) {
+    const Message &msg = inputs.telemetry->values[name];
+    return msg.name == name ? (float)msg.value_status : NAN;
+}
+
+static const Cell_summary *cell_summary(const Publish_inputs &inputs) {
+    const Message &msg = inputs.telemetry->values[Message_name::cell_voltages];
+    return msg.name == Message_name::cell_voltages ? &msg.value_cell_summary : NULL;
+}
+
+// Topic table. Status values are the integers of the Message_status enum.
+static const Mqtt_topic topics[] = {
+    // Position: about 100m, at most every 30s while driving
+    { "lat", [](const Publish_inputs &in) { return in.gnss_fix ? in.gnss_fix->latitude : NAN; }, 6, PUBLISH_ON_CHANGE(0.001, 30, 300, 3600) },
+    { "lon", [](const Publish_inputs &in) { return in.gnss_fix ? in.gnss_fix->longitude : NAN; }, 6, PUBLISH_ON_CHANGE(0.001, 30, 300, 3600) },
+    { "speed", [](const Publish_inputs &in) { return in.gnss_fix ? in.gnss_fix->speed : NAN; }, 1, PUBLISH_ON_CHANGE(10, 30, 300, 3600) },
+
+    // Energy steps (about 1% SOC) and the charger are events
+    { "batteryKWH", [](const Publish_inputs &in) { return telemetry_float(in, Message_name::battery_energy_kwh); }, 1, PUBLISH_EVENT(0.3, 600, 3600) },
+    { "batteryKW", [](const Publish_inputs &in) { return in.battery_power_kw; }, 1, PUBLISH_ON_CHANGE(2, 30, 300, 3600) },
+    { "chargerMaxAmps", [](const Publish_inputs &in) { return telemetry_float(in, Message_name::charger_max_amps); }, 1, PUBLISH_EVENT(0, 600, 3600) },
+
+    // Battery cells (polled from the LBC)
+    { "cellMinMv", [](const Publish_inputs &in) { return cell_summary(in) ? (float)cell_summary(in)->min_mv : NAN; }, 0, PUBLISH_ON_CHANGE(10, 60, 600, 3600) },
+    { "cellMaxMv", [](const Publish_inputs &in) { return cell_summary(in) ? (float)cell_summary(in)->max_mv : NAN; }, 0, PUBLISH_ON_CHANGE(10, 60, 600, 3600) },
+    { "batteryTemp", [](const Publish_inputs &in) { return telemetry_float(in, Message_name::battery_temperature); }, 0, PUBLISH_ON_CHANGE(1, 60, 600, 3600) },
+
+    { "altitude", [](const Publish_inputs &in) { return telemetry_float(in, Message_name::pressure_altitude); }, 1, PUBLISH_ON_CHANGE(20, 60, 600, 3600) },
+    { "pcbTemperature", [](const Publish_inputs &in) { return telemetry_float(in, Message_name::pcb_temperature); }, 1, PUBLISH_ON_CHANGE(2, 60, 600, 3600) },
+
+    { "acStatus", [](const Publish_inputs &in) { return telemetry_status(in, Message_name::ac_status); }, 0, PUBLISH_EVENT(0, 600, 3600) },
+    { "chargerStatus", [](const Publish_inputs &in) { return telemetry_status(in, Message_name::charger_status); }, 0, PUBLISH_EVENT(0, 600, 3600) },
+};
+
+static constexpr int n_topics = sizeof(topics) / sizeof(topics[0]);
+static_assert(n_topics <= 32, "One bit per topic in a uint32_t");
+
+struct Topic_state {
+    float value;                // Captured by mqtt_schedule_due()
+    float sent_value;
+    int64_t sent_us;            // 0 if never published
+};
+
+static Topic_state states[n_topics] = {};
+
+
+uint32_t mqtt_schedule_due(const Publish_inputs &inputs, bool active, bool force, int64_t now_us) {
+    uint32_t due = 0;
+
+    for ( int i = 0; i < n_topics; i++ ) {
+        const Publish_policy &policy = topics[i].policy;
+        Topic_state &state = states[i];
+
+        state.value = topics[i].read(inputs);
+        if ( isnan(state.value) ) {
+            continue;
+        }
+
+        int64_t since_sent_us = now_us - state.sent_us;
+        uint16_t max_interval_s = active ? policy.max_active_s : policy.max_idle_s;
+
+        bool never_sent = state.sent_us == 0;
+        bool changed = fabsf(state.value - state.sent_value) > policy.deadband;
+        bool too_soon = policy.event ? since_sent_us < MQTT_EVENT_MIN_INTERVAL_MS * 1000LL : since_sent_us < policy.min_interval_s * 1000000LL;
+        bool overdue = max_interval_s > 0 && since_sent_us >= max_interval_s * 1000000LL;
+
+        if ( force || never_sent || overdue || ( changed && !too_soon ) ) {
+            due |= 1UL << i;
+        }
+    }
+
+    return due;
+}
+
+void mqtt_schedule_sent(uint32_t sent, int64_t now_us) {
+    for ( int i = 0; i < n_topics; i++ ) {
+        if ( sent & ( 1UL << i ) ) {
+            states[i].sent_value = states[i].value;
+            states[i].sent_us = now_us;
+        }
+    }
+}
+
+int mqtt_topic_count() {
+    return n_topics;
+}
+
+const char *mqtt_topic_name(int topic) {
+    return topics[topic].name;
+}
+
+int mqtt_topic_format(int topic, char *buf, size_t size) {
+    return snprintf(buf, size, "%.*f", topics[topic].decimals, states[topic].value);
+}
+
+int mqtt_schedule_format_packed(uint32_t due, char *buf, size_t size) {
+    int n = snprintf(buf, size, "{");
+
+    for ( int i = 0; i < n_topics && n < (int)size; i++ ) {
+        if ( due & ( 1UL << i ) ) {
+            n += snprintf(buf + n, size - n, "%s\"%s\":%.*f", n > 1 ? "," : "", topics[i].name, topics[i].decimals, states[i].value);
+        }
+    }
+
+    if ( clock_valid() && n < (int)size ) {
+        n += snprintf(buf + n, size - n, "%s\"time\":%lld", n > 1 ? "," : "", (long long)( clock_now_us() / 1000 ));
+    }
+
+    if ( n < (int)size ) {
+        n += snprintf(buf + n, size - n, "}");
+    }
+
+    return n;
+}
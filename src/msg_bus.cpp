@@ -0,0 +1,211 @@
+#include <Arduino.h>
+#include <esp_timer.h>
+
+#include "globals.h"
+#include "functions.h"
+#include "msg_bus.h"
+#include "telemetry.h"
+
+struct Bus_queue {
+    QueueHandle_t handle;
+    Overflow_policy policy;
+    TickType_t block_ticks;
+    int64_t full_since_us;  // 0 when the queue was not full at the last send
+    Queue_stats stats;
+};
+
+static Bus_queue queues[MSG_MAX_QUEUES] = {};
+static int n_queues = 0;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static Bus_queue *sink_queues[Message_sink::sink_count] = {};
+static int forwarder_queue = -1;
+
+// Runtime copy of the subscriber masks, so that sinks can subscribe to more messages at startup
+static uint8_t subscribers[Message_name::message_name_count] = {
+    MESSAGE_TABLE(MESSAGE_TABLE_SINKS)
+};
+
+
+int msg_queue_register(const char *name, QueueHandle_t queue, uint32_t length, Overflow_policy policy, uint32_t block_ms) {
+    if ( n_queues >= MSG_MAX_QUEUES ) {
+        return -1;
+    }
+
+    Bus_queue &q = queues[n_queues];
+
+    q.handle = queue;
+    q.policy = policy;
+    q.block_ticks = pdMS_TO_TICKS(block_ms);
+    q.full_since_us = 0;
+    q.stats.name = name;
+    q.stats.length = length;
+
+    return n_queues++;
+}
+
+static bool queue_send(Bus_queue &q, const Message &msg) {
+    TickType_t wait = q.policy == Overflow_policy::block ? q.block_ticks : 0;
+    bool sent = xQueueSendToBack(q.handle, &msg, wait) == pdTRUE;
+
+    // drop_oldest: make room and retry once. The retry can still fail if another sender took the free slot.
+    bool evicted = false;
+    bool requeued = false;
+    if ( !sent && q.policy == Overflow_policy::drop_oldest ) {
+        Message discarded;
+        evicted = xQueueReceive(q.handle, &discarded, 0) == pdTRUE;
+        requeued = xQueueSendToBack(q.handle, &msg, 0) == pdTRUE;
+    }
+
+    uint32_t waiting = uxQueueMessagesWaiting(q.handle);
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&stats_lock);
+
+    if ( sent || requeued ) {
+        q.stats.sends++;
+    }
+    else {
+        q.stats.drops++;
+    }
+
+    // With drop_oldest the new message is queued, but the evicted one is lost all the same
+    if ( evicted ) {
+        q.stats.drops++;
+    }
+
+    if ( waiting > q.stats.peak ) {
+        q.stats.peak = waiting;
+    }
+
+    // Time spent full is measured between sends that find the queue full and the next one that does not
+    if ( waiting >= q.stats.length ) {
+        if ( q.full_since_us == 0 ) {
+            q.full_since_us = now;
+        }
+    }
+    else if ( q.full_since_us != 0 ) {
+        q.stats.full_time_us += now - q.full_since_us;
+        q.full_since_us = 0;
+    }
+
+    portEXIT_CRITICAL(&stats_lock);
+
+    return sent;
+}
+
+bool msg_queue_send(int queue_id, const Message &msg) {
+    if ( queue_id < 0 || queue_id >= n_queues ) {
+        return false;
+    }
+
+    return queue_send(queues[queue_id], msg);
+}
+
+int msg_queue_count() {
+    return n_queues;
+}
+
+void msg_queue_stats(int queue_id, Queue_stats *stats) {
+    portENTER_CRITICAL(&stats_lock);
+
+    *stats = queues[queue_id].stats;
+
+    // Include the time elapsed since the queue became full
+    if ( queues[queue_id].full_since_us != 0 ) {
+        stats->full_time_us += esp_timer_get_time() - queues[queue_id].full_since_us;
+    }
+
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void msg_print_stats() {
+    for ( int i = 0; i < n_queues; i++ ) {
+        Queue_stats stats;
+        msg_queue_stats(i, &stats);
+
+        debug_printf("Queue %-10s sends %u, drops %u, peak %u/%u, full %lld ms\n",
+            stats.name, (unsigned)stats.sends, (unsigned)stats.drops, (unsigned)stats.peak, (unsigned)stats.length,
+            (long long)( stats.full_time_us / 1000 ));
+    }
+}
+
+int msg_format_stats(char *buf, size_t len) {
+    int n = snprintf(buf, len, "{");
+
+    for ( int i = 0; i < n_queues && n < (int)len; i++ ) {
+        Queue_stats stats;
+        msg_queue_stats(i, &stats);
+
+        n += snprintf(buf + n, len - n, "%s\"%s\":{\"sends\":%u,\"drops\":%u,\"peak\":%u,\"len\":%u,\"full_ms\":%lld}",
+            i > 0 ? "," : "",
+            stats.name, (unsigned)stats.sends, (unsigned)stats.drops, (unsigned)stats.peak, (unsigned)stats.length,
+            (long long)( stats.full_time_us / 1000 ));
+    }
+
+    if ( n < (int)len ) {
+        n += snprintf(buf + n, len - n, "}");
+    }
+
+    return n;
+}
+
+void msg_register_sink(Message_sink sink, int queue_id) {
+    if ( queue_id >= 0 && queue_id < n_queues ) {
+        sink_queues[sink] = &queues[queue_id];
+    }
+}
+
+void msg_register_forwarder(int queue_id) {
+    forwarder_queue = queue_id;
+}
+
+void msg_subscribe(Message_sink sink, Message_name name) {
+    subscribers[name] |= 1 << sink;
+}
+
+void msg_route(const Message &msg) {
+    if ( msg.name >= Message_name::message_name_count ) {
+        return;
+    }
+
+    if ( msg_route_timing ) {
+        msg_route_timing(false, msg.timestamp_us);
+    }
+
+    uint8_t mask = subscribers[msg.name];
+
+    // Loop over the set bits only
+    while ( mask ) {
+        int sink = __builtin_ctz(mask);
+        mask &= mask - 1;
+
+        if ( sink == Message_sink::sink_state ) {
+            telemetry_write(msg);
+        }
+        else if ( sink_queues[sink] != NULL ) {
+            queue_send(*sink_queues[sink], msg);
+        }
+    }
+
+    if ( msg_route_timing ) {
+        msg_route_timing(true, msg.timestamp_us);
+    }
+}
+
+void msg_publish(const Message &msg) {
+    if ( msg_publish_timing ) {
+        msg_publish_timing(false, msg.timestamp_us);
+    }
+
+    if ( forwarder_queue >= 0 ) {
+        msg_queue_send(forwarder_queue, msg);
+    }
+    else {
+        msg_route(msg);
+    }
+
+    if ( msg_publish_timing ) {
+        msg_publish_timing(true, msg.timestamp_us);
+    }
+}
@@ -7,32 +7,49 @@
 #include "globals.h"
 #include "config.h"
 #include "functions.h"
+#include "telemetry.h"
+#include "can_capture.h"
+#include "mqtt_backlog.h"
+#include "track.h"
+#include "wall_clock.h"
 
 const int SD_CS = 4;
 
+// Open a new capture file, /can_0000.ccap, /can_0001.ccap...
+static File open_capture_file() {
+    char path[20];
+
+    for ( int n = 0; n < 10000; n++ ) {
+        snprintf(path, sizeof(path), "/can_%04d.ccap", n);
+
+        if ( !SD.exists(path) ) {
+            debug_printf("CAN capture to %s\n", path);
+            return SD.open(path, FILE_WRITE);
+        }
+    }
+
+    return File();
+}
 
 void logger_task( void *parameter ) {
 
-    float battery_kwh = 0;
+    // Smoothed locally, all other values are read from the telemetry store
     float battery_kw = 0;
     float speed_tacho = 0;
-    float speed_gnss = 0;
-    float latitude = 0;
-    float longitude = 0;
-    float altitude = 0;
-    float latitude_network = 0;
-    float longitude_network = 0;
-    int gsm_day = 0;
-    int gsm_month = 0;
-    int gsm_year = 0;
-    int gsm_hours = 0;
-    int gsm_minutes = 0;
-    int gsm_seconds = 0;
-
-    Message_status car_status = Message_status::car_is_off;
-    Message_status charger_status = Message_status::charger_idle;
+    float energy_kwh = 0;
+    float last_power_kw = 0;
+    int64_t last_speed_time_us = 0;
+    int64_t last_power_time_us = 0;
+
+    // Static: about 1 kB, the task has a 4 kB stack
+    static Telemetry telemetry;
 
     unsigned long last_log_time = 0;
+    unsigned long last_backlog_time = 0;
+
+    // The SD-card stays mounted while a capture file is open
+    File capture_file;
+    bool capturing = false;
 
     for(;;) {
         // UBaseType_t highWatermark = uxTaskGetStackHighWaterMark(NULL);
@@ -42,71 +59,22 @@ void logger_task( void *parameter ) {
         while ( xQueueReceive(q_logger, &received_msg, 0 ) == pdTRUE ) {
             switch ( received_msg.name ) {
                 case Message_name::speed_kmh:
-                    exp_smooth(&speed_tacho, received_msg.value_float, LOG_SMOOTHING);
-                    break;
-
-                case Message_name::gnss_speed:
-                    speed_gnss = received_msg.value_float;
-                    break;
-
-                case Message_name::gnss_latitude:
-                    latitude = received_msg.value_float;
-                    break;
-
-                case Message_name::gnss_longitude:
-                    longitude = received_msg.value_float;
-                    break;
-
-                case Message_name::gnss_altitude:
-                    altitude = received_msg.value_float;
-                    break;
-
-                case Message_name::network_latitude:
-                    latitude_network = received_msg.value_float;
-                    break;
-
-                case Message_name::network_longitude:
-                    longitude_network = received_msg.value_float;
+                    exp_smooth(&speed_tacho, received_msg.value_float, LOG_SMOOTHING, received_msg.timestamp_us - last_speed_time_us);
+                    last_speed_time_us = received_msg.timestamp_us;
                     break;
 
                 case Message_name::battery_power_kw:
-                    exp_smooth(&battery_kw, received_msg.value_float, LOG_SMOOTHING);
-                    break;
+                    exp_smooth(&battery_kw, received_msg.value_float, LOG_SMOOTHING, received_msg.timestamp_us - last_power_time_us);
 
-                case Message_name::battery_energy_kwh:
-                    battery_kwh = received_msg.value_float;
-                    break;
+                    // Energy through the battery since boot. Power is only published when it changes (emit policies),
+                    // so the previous value held until this sample (left sum). A longer gap means the bus was silent.
+                    if ( last_power_time_us != 0
+                        && received_msg.timestamp_us - last_power_time_us <= LOG_ENERGY_MAX_GAP_MS * 1000LL ) {
+                        energy_kwh += last_power_kw * ( received_msg.timestamp_us - last_power_time_us ) / 3.6e9;
+                    }
 
-                case Message_name::gsm_year:
-                    gsm_year = received_msg.value_int;
-                    break;
-                
-                case Message_name::gsm_month:
-                    gsm_month = received_msg.value_int;
-                    break;
-                
-                case Message_name::gsm_day:
-                    gsm_day = received_msg.value_int;
-                    break;
-                
-                case Message_name::gsm_hours:
-                    gsm_hours = received_msg.value_int;
-                    break;
-                
-                case Message_name::gsm_minutes:
-                    gsm_minutes = received_msg.value_int;
-                    break;
-                
-                case Message_name::gsm_seconds:
-                    gsm_seconds = received_msg.value_int;
-                    break;
-
-                case Message_name::car_status:
-                    car_status = received_msg.value_status;
-                    break;
-
-                case Message_name::charger_status:
-                    charger_status = received_msg.value_status;
+                    last_power_kw = received_msg.value_float;
+                    last_power_time_us = received_msg.timestamp_us;
                     break;
                 
                 default:
@@ -114,6 +82,12 @@ void logger_task( void *parameter ) {
             }
         }
 
+        telemetry_read(&telemetry);
+
+        Gnss_fix &gnss_fix = telemetry.values[Message_name::gnss_fix].value_gnss_fix;
+        Message_status car_status = telemetry.values[Message_name::car_status].value_status;
+        Message_status charger_status = telemetry.values[Message_name::charger_status].value_status;
+
         // Log every 15min by default
         int log_interval_s = 15*60;
 
@@ -133,7 +107,21 @@ void logger_task( void *parameter ) {
 
             last_log_time = millis();
 
-            if ( SD.begin(SD_CS) ) {
+            // Stamp the row with the time of the newest sample it contains
+            int64_t sample_time_us = last_speed_time_us > last_power_time_us ? last_speed_time_us : last_power_time_us;
+            for ( int i = 0; i < Message_name::message_name_count; i++ ) {
+                if ( telemetry.values[i].timestamp_us > sample_time_us ) {
+                    sample_time_us = telemetry.values[i].timestamp_us;
+                }
+            }
+
+            // UTC date and time of the sample, zeros until the clock is set
+            Date_time date_time = {};
+            if ( clock_valid() ) {
+                clock_date_time(clock_epoch_us(sample_time_us), &date_time);
+            }
+
+            if ( capturing || SD.begin(SD_CS) ) {
                 send_msg(Message_name::logger_status, Message_status::logger_write_started);
 
                 bool log_exists = SD.exists("/log.csv");
@@ -141,25 +129,76 @@ void logger_task( void *parameter ) {
                 File logfile = SD.open("/log.csv", FILE_APPEND);
 
                 if ( !log_exists ) {
-                    logfile.println("time (ms),GSM date,GSM time,speed (km/h),GNSS speed (km/h),latitude (deg),longitude (deg),altitude (m),network latitude (deg),network longitude (deg),battery power (kW),battery energy (kWh)");
+                    logfile.println("time (ms),UTC date,UTC time,speed (km/h),GNSS speed (km/h),latitude (deg),longitude (deg),altitude (m),network latitude (deg),network longitude (deg),battery power (kW),battery energy (kWh),integrated energy (kWh)");
                 }
 
-                logfile.printf("%lu,%02d/%02d/%02d,%02d:%02d:%02d,%.1f,%.1f,%.6f,%.6f,%.1f,%.6f,%.6f,%.2f,%.2f\n",
-                    millis(), gsm_year, gsm_month, gsm_day, gsm_hours, gsm_minutes, gsm_seconds,
-                    speed_tacho, speed_gnss,
-                    latitude, longitude, altitude,
-                    latitude_network, longitude_network,
-                    battery_kw, battery_kwh);
+                logfile.printf("%lu,%02d/%02d/%02d,%02d:%02d:%02d,%.1f,%.1f,%.6f,%.6f,%.1f,%.6f,%.6f,%.2f,%.2f,%.3f\n",
+                    (unsigned long)( sample_time_us / 1000 ),
+                    date_time.year, date_time.month, date_time.day,
+                    date_time.hours, date_time.minutes, date_time.seconds,
+                    speed_tacho, gnss_fix.speed,
+                    gnss_fix.latitude, gnss_fix.longitude, gnss_fix.altitude,
+                    telemetry.values[Message_name::network_latitude].value_float,
+                    telemetry.values[Message_name::network_longitude].value_float,
+                    battery_kw,
+                    telemetry.values[Message_name::battery_energy_kwh].value_float,
+                    energy_kwh);
 
                 logfile.close();
             }
 
-            SD.end();
+            if ( !capturing ) {
+                SD.end();
+            }
 
             send_msg(Message_name::logger_status, Message_status::logger_write_ended);
         }
 
-        // Slow down the task
-        delay(100);
+        // MQTT backlog: spill while offline, read back while online. GNSS track segments.
+        if ( millis() - last_backlog_time > 1000 && ( backlog_sd_pending() || track_sd_pending() ) ) {
+            last_backlog_time = millis();
+
+            bool mounted = capturing || SD.begin(SD_CS);
+            if ( backlog_sd_pending() ) {
+                backlog_sd_sync(mounted ? &SD : NULL);
+            }
+
+            if ( mounted ) {
+                track_sd_write(SD);
+            }
+
+            if ( mounted && !capturing ) {
+                SD.end();
+            }
+        }
+
+        // Raw CAN capture
+        if ( !capturing && can_capture_active() && SD.begin(SD_CS) ) {
+            capture_file = open_capture_file();
+            capturing = capture_file;
+            can_capture_set_writing(capturing);
+
+            if ( !capturing ) {
+                SD.end();
+            }
+        }
+
+        if ( capturing ) {
+            // Also slows down the task
+            if ( can_capture_write(capture_file, pdMS_TO_TICKS(100)) > 0 ) {
+                capture_file.flush();
+            }
+
+            if ( !can_capture_active() && !can_capture_pending() ) {
+                capture_file.close();
+                SD.end();
+                capturing = false;
+                can_capture_set_writing(false);
+            }
+        }
+        else {
+            // Slow down the task
+            delay(100);
+        }
     }
 }
@@ -0,0 +1,334 @@
+#include <Arduino.h>
+#include <driver/can.h>
+
+#include "config.h"
+#include "can_bus.h"
+#include "can_filter.h"
+#include "slcan.h"
+
+#define SLCAN_OK '\r'
+#define SLCAN_ERROR '\a'
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+static QueueHandle_t q_slcan = xQueueCreate(SLCAN_QUEUE_LENGTH, sizeof(Can_frame));
+
+static volatile bool is_open = false;
+static bool listen_only = false;        // Opened with L: controller in listen-only mode, no transmission
+static bool timestamps = false;
+static can_filter_config_t filter = CAN_FILTER_CONFIG_ACCEPT_ALL();
+
+static char out[SLCAN_BUFFER_SIZE];
+static size_t out_len = 0;
+
+// Command being received
+static char line[32];
+static size_t line_len = 0;
+
+// Longest encoded frame: T, 8 ID digits, DLC, 16 data digits, 4 timestamp digits, CR
+#define SLCAN_MAX_FRAME_LEN 31
+
+
+static inline char *put_hex(char *p, uint32_t value, int digits) {
+    for ( int i = digits - 1; i >= 0; i-- ) {
+        p[i] = hex_digits[value & 0xF];
+        value >>= 4;
+    }
+    return p + digits;
+}
+
+static void flush_output() {
+    if ( out_len > 0 ) {
+        Serial.write((const uint8_t *)out, out_len);
+        out_len = 0;
+    }
+}
+
+static void put_response(const char *response) {
+    size_t len = strlen(response);
+
+    if ( out_len + len > sizeof(out) ) {
+        flush_output();
+    }
+
+    memcpy(out + out_len, response, len);
+    out_len += len;
+}
+
+static void encode_frame(const Can_frame &frame) {
+    if ( out_len + SLCAN_MAX_FRAME_LEN > sizeof(out) ) {
+        flush_output();
+    }
+
+    const can_message_t &msg = frame.msg;
+    bool extended = msg.flags & CAN_MSG_FLAG_EXTD;
+    bool rtr = msg.flags & CAN_MSG_FLAG_RTR;
+    uint8_t dlc = msg.data_length_code > 8 ? 8 : msg.data_length_code;
+
+    char *p = out + out_len;
+
+    if ( extended ) {
+        *p++ = rtr ? 'R' : 'T';
+        p = put_hex(p, msg.identifier, 8);
+    }
+    else {
+        *p++ = rtr ? 'r' : 't';
+        p = put_hex(p, msg.identifier, 3);
+    }
+
+    *p++ = hex_digits[dlc];
+
+    if ( !rtr ) {
+        for ( int i = 0; i < dlc; i++ ) {
+            p = put_hex(p, msg.data[i], 2);
+        }
+    }
+
+    // Milliseconds, wrapping every minute
+    if ( timestamps ) {
+        p = put_hex(p, ( frame.timestamp_us / 1000 ) % 60000, 4);
+    }
+
+    *p++ = '\r';
+
+    out_len = p - out;
+}
+
+bool slcan_is_open() {
+    return is_open;
+}
+
+void slcan_open() {
+    // All IDs are received while open, those outside the M/m filter are dropped by slcan_task. The serial port only carries SLCAN:
+    // debug_printf() output is dropped, and so is the core debug output.
+    Serial.setDebugOutput(false);
+    is_open = true;
+    xQueueReset(q_slcan);
+    can_bus_accept_all(can_filter_slcan, true);
+    can_bus_set_monitor(q_slcan);
+}
+
+void slcan_close() {
+    can_bus_set_monitor(NULL);
+    can_bus_accept_all(can_filter_slcan, false);
+    is_open = false;
+    if ( listen_only ) {
+        can_bus_set_listen_only(false);
+        listen_only = false;
+    }
+    Serial.setDebugOutput(ENABLE_SERIAL_DEBUG);
+}
+
+// Parse n hex digits, returns false if one of them is not a hex digit
+static bool parse_hex(const char *p, int n, uint32_t *value) {
+    *value = 0;
+
+    for ( int i = 0; i < n; i++ ) {
+        char c = p[i];
+        uint32_t digit;
+
+        if ( c >= '0' && c <= '9' ) {
+            digit = c - '0';
+        }
+        else if ( c >= 'A' && c <= 'F' ) {
+            digit = c - 'A' + 10;
+        }
+        else if ( c >= 'a' && c <= 'f' ) {
+            digit = c - 'a' + 10;
+        }
+        else {
+            return false;
+        }
+
+        *value = ( *value << 4 ) | digit;
+    }
+
+    return true;
+}
+
+// t/T/r/R: transmit a frame, without waiting for room in the driver TX queue
+static bool transmit(const char *cmd, size_t len) {
+    bool extended = cmd[0] == 'T' || cmd[0] == 'R';
+    bool rtr = cmd[0] == 'r' || cmd[0] == 'R';
+    int id_digits = extended ? 8 : 3;
+
+    can_message_t msg = {};
+    uint32_t value;
+
+    if ( len < (size_t)id_digits + 2 || !parse_hex(cmd + 1, id_digits, &msg.identifier) || !parse_hex(cmd + 1 + id_digits, 1, &value) || value > 8 ) {
+        return false;
+    }
+
+    msg.data_length_code = value;
+    msg.flags = ( extended ? CAN_MSG_FLAG_EXTD : 0 ) | ( rtr ? CAN_MSG_FLAG_RTR : 0 );
+
+    if ( !rtr ) {
+        if ( len != (size_t)id_digits + 2 + 2 * msg.data_length_code ) {
+            return false;
+        }
+
+        for ( int i = 0; i < msg.data_length_code; i++ ) {
+            if ( !parse_hex(cmd + id_digits + 2 + 2 * i, 2, &value) ) {
+                return false;
+            }
+            msg.data[i] = value;
+        }
+    }
+
+    return can_bus_transmit(&msg, 0) == ESP_OK;
+}
+
+// Status flags (since the last F command): bit 0 SLCAN queue full, bit 3 frames lost by the receiver,
+// bit 5 error passive, bit 7 bus error
+static uint8_t status_flags() {
+    static Can_bus_stats last = {};
+
+    Can_bus_stats stats;
+    can_bus_stats(&stats);
+
+    uint8_t flags = 0;
+    if ( stats.monitor_drops != last.monitor_drops ) {
+        flags |= 0x01;
+    }
+    if ( stats.driver_missed != last.driver_missed || stats.ring_drops != last.ring_drops ) {
+        flags |= 0x08;
+    }
+    if ( stats.error_passive != last.error_passive ) {
+        flags |= 0x20;
+    }
+    if ( stats.bus_errors != last.bus_errors || stats.bus_off != last.bus_off ) {
+        flags |= 0x80;
+    }
+
+    last = stats;
+    return flags;
+}
+
+static void execute(const char *cmd, size_t len) {
+    char response[8] = { SLCAN_ERROR, 0 };
+    uint32_t value;
+
+    switch ( cmd[0] ) {
+        case 'O':
+        case 'L':
+            if ( len == 1 && !is_open ) {
+                listen_only = cmd[0] == 'L';
+                can_bus_set_listen_only(listen_only);
+                slcan_open();
+                response[0] = SLCAN_OK;
+            }
+            break;
+
+        case 'C':
+            if ( len == 1 && is_open ) {
+                slcan_close();
+                response[0] = SLCAN_OK;
+            }
+            break;
+
+        // EV-CAN runs at 500kbit/s, nothing else is supported
+        case 'S':
+            if ( len == 2 && cmd[1] == '6' && !is_open ) {
+                response[0] = SLCAN_OK;
+            }
+            break;
+
+        case 't':
+        case 'T':
+        case 'r':
+        case 'R':
+            if ( is_open && !listen_only && transmit(cmd, len) ) {
+                response[0] = cmd[0] == 't' || cmd[0] == 'r' ? 'z' : 'Z';
+                response[1] = SLCAN_OK;
+                response[2] = 0;
+            }
+            break;
+
+        case 'M':
+        case 'm':
+            if ( len == 9 && !is_open && parse_hex(cmd + 1, 8, &value) ) {
+                if ( cmd[0] == 'M' ) {
+                    filter.acceptance_code = value;
+                }
+                else {
+                    filter.acceptance_mask = value;
+                }
+                filter.single_filter = false;
+                response[0] = SLCAN_OK;
+            }
+            break;
+
+        case 'F':
+            if ( len == 1 && is_open ) {
+                char *p = response;
+                *p++ = 'F';
+                p = put_hex(p, status_flags(), 2);
+                *p++ = SLCAN_OK;
+                *p = 0;
+            }
+            break;
+
+        case 'Z':
+            if ( len == 2 && ( cmd[1] == '0' || cmd[1] == '1' ) ) {
+                timestamps = cmd[1] == '1';
+                response[0] = SLCAN_OK;
+            }
+            break;
+
+        case 'V':
+            strcpy(response, "V1013\r");
+            break;
+
+        case 'v':
+            strcpy(response, "v1013\r");
+            break;
+
+        case 'N':
+            strcpy(response, "NCC01\r");
+            break;
+
+        default:
+            break;
+    }
+
+    put_response(response);
+}
+
+// Read and execute the commands waiting on the serial port
+static void poll_commands() {
+    while ( Serial.available() ) {
+        int c = Serial.read();
+        if ( c < 0 ) {
+            break;
+        }
+
+        if ( c == '\r' || c == '\n' ) {
+            if ( line_len > 0 ) {
+                execute(line, line_len);
+            }
+            line_len = 0;
+        }
+        else if ( line_len < sizeof(line) ) {
+            line[line_len++] = c;
+        }
+    }
+
+}
+
+void slcan_task( void *parameter ) {
+    for (;;) {
+        // Encode the frames received since the last write
+        Can_frame frame;
+        int n_frames = 0;
+        while ( n_frames < SLCAN_QUEUE_LENGTH && xQueueReceive(q_slcan, &frame, n_frames == 0 ? pdMS_TO_TICKS(10) : 0) == pdTRUE ) {
+            n_frames++;
+
+            if ( is_open && can_filter_accepts(filter, frame.msg) ) {
+                encode_frame(frame);
+            }
+        }
+
+        poll_commands();
+        flush_output();
+    }
+}
@@ -0,0 +1,49 @@
+#include <Arduino.h>
+#include <atomic>
+
+#include "globals.h"
+#include "telemetry.h"
+
+/*
+Seqlock protected store: writers increment the sequence number before and after
+updating a value, readers retry their copy if the sequence was odd or changed meanwhile.
+Writers can run on both cores, they are serialized with a spinlock.
+*/
+
+static Telemetry state;
+static std::atomic<uint32_t> sequence(0);
+static portMUX_TYPE write_lock = portMUX_INITIALIZER_UNLOCKED;
+
+
+void telemetry_write(const Message &msg) {
+    portENTER_CRITICAL(&write_lock);
+
+    uint32_t seq = sequence.load(std::memory_order_relaxed);
+    sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    state.values[msg.name] = msg;
+
+    sequence.store(seq + 2, std::memory_order_release);
+
+    portEXIT_CRITICAL(&write_lock);
+}
+
+void telemetry_read(Telemetry *snapshot) {
+    uint32_t seq_before;
+    uint32_t seq_after;
+
+    do {
+        seq_before = sequence.load(std::memory_order_acquire);
+
+        // A write is in progress
+        if ( seq_before & 1 ) {
+            continue;
+        }
+
+        memcpy(snapshot, &state, sizeof(Telemetry));
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        seq_after = sequence.load(std::memory_order_relaxed);
+    } while ( ( seq_before & 1 ) || seq_before != seq_after );
+}
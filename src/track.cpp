@@ -0,0 +1,299 @@
+#include <Arduino.h>
+#include <FS.h>
+#include <math.h>
+
+#include "config.h"
+#include "track.h"
+#include "mqtt_backlog.h"
+#include "wall_clock.h"
+
+#include <esp_timer.h>
+
+#define TRACK_PATH "/track.bin"
+
+static_assert(sizeof(Track_segment_header) == 24, "Track_segment_header size");
+static_assert(4 * ( ( sizeof(Track_segment) + 2 ) / 3 ) + 64 <= sizeof(Backlog_record::payload), "Track segment JSON fits in a backlog record");
+
+struct Track_point {
+    int32_t time_ds;                // esp_timer time in 100 ms units
+    int32_t lat_e5;
+    int32_t lon_e5;
+};
+
+static portMUX_TYPE track_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Simplification and encoding, comm_gnss_task only
+static bool have_anchor = false;
+static Track_point anchor;                  // Last kept point
+static float lon_scale;                     // cos(latitude) of the anchor
+static Track_point window[TRACK_WINDOW];    // Fixes since the anchor, not kept (yet)
+static int window_count = 0;
+
+static Track_segment current = {};          // Being filled
+static Track_point previous;                // Last point of the current segment
+static uint32_t next_seq = 0;
+
+// Closed segments: uploaded by comm_gnss_task, written to the SD-card by logger_task.
+// Counters of segments since boot, the slot of segment n is n % TRACK_SEGMENT_QUEUE.
+static Track_segment queue[TRACK_SEGMENT_QUEUE];
+static uint32_t closed = 0;
+static uint32_t uploaded = 0;
+static uint32_t sd_next = 0;
+
+static Track_stats counters = {};
+
+
+// Distance of p from the line segment a-b, in metres
+static float distance_m(const Track_point &a, const Track_point &b, const Track_point &p) {
+    float bx = ( b.lon_e5 - a.lon_e5 ) * lon_scale;
+    float by = b.lat_e5 - a.lat_e5;
+    float px = ( p.lon_e5 - a.lon_e5 ) * lon_scale;
+    float py = p.lat_e5 - a.lat_e5;
+
+    float length2 = bx * bx + by * by;
+    float t = length2 > 0 ? ( px * bx + py * by ) / length2 : 0;
+    if ( t < 0 ) {
+        t = 0;
+    }
+    else if ( t > 1 ) {
+        t = 1;
+    }
+
+    float dx = px - t * bx;
+    float dy = py - t * by;
+
+    // 1e-5 degree of latitude
+    return sqrtf(dx * dx + dy * dy) * 1.1132f;
+}
+
+static int put_varint(uint8_t *out, int32_t value) {
+    uint32_t zigzag = ( (uint32_t)value << 1 ) ^ (uint32_t)( value >> 31 );
+    int n = 0;
+
+    while ( zigzag >= 0x80 ) {
+        out[n++] = ( zigzag & 0x7F ) | 0x80;
+        zigzag >>= 7;
+    }
+    out[n++] = zigzag;
+
+    return n;
+}
+
+static void close_segment() {
+    if ( current.header.points == 0 ) {
+        return;
+    }
+
+    current.header.magic = TRACK_MAGIC;
+    current.header.version = TRACK_VERSION;
+    current.header.seq = next_seq++;
+    current.header.boot = backlog_boot();
+    current.header.epoch_offset_ms = clock_valid() ? clock_now_us() / 1000 - esp_timer_get_time() / 1000 : 0;
+
+    portENTER_CRITICAL(&track_mux);
+
+    // Overwrite the oldest segment when a reader is behind
+    if ( closed - sd_next >= TRACK_SEGMENT_QUEUE ) {
+        sd_next++;
+        counters.sd_dropped++;
+    }
+    if ( closed - uploaded >= TRACK_SEGMENT_QUEUE ) {
+        uploaded++;
+    }
+
+    queue[closed % TRACK_SEGMENT_QUEUE] = current;
+    closed++;
+
+    counters.segments++;
+    counters.bytes += sizeof(current.header) + current.header.length;
+
+    portEXIT_CRITICAL(&track_mux);
+
+    current.header = {};
+}
+
+// The first point of a segment is absolute, the others are differences from the previous one
+static void encode(const Track_point &point) {
+    uint8_t bytes[15];
+
+    for ( int attempt = 0; attempt < 2; attempt++ ) {
+        Track_point base = current.header.points == 0 ? Track_point{} : previous;
+
+        int n = put_varint(bytes, point.time_ds - base.time_ds);
+        n += put_varint(bytes + n, point.lat_e5 - base.lat_e5);
+        n += put_varint(bytes + n, point.lon_e5 - base.lon_e5);
+
+        if ( current.header.length + n > TRACK_SEGMENT_SIZE || current.header.points == 255 ) {
+            close_segment();
+            continue;
+        }
+
+        memcpy(current.data + current.header.length, bytes, n);
+        current.header.length += n;
+        current.header.points++;
+        previous = point;
+
+        portENTER_CRITICAL(&track_mux);
+        counters.points++;
+        portEXIT_CRITICAL(&track_mux);
+        return;
+    }
+}
+
+static void keep(const Track_point &point) {
+    anchor = point;
+    have_anchor = true;
+    lon_scale = cosf(point.lat_e5 * 1e-5f * M_PI / 180);
+    window_count = 0;
+
+    encode(point);
+}
+
+void track_add(const Gnss_fix &fix, int64_t timestamp_us) {
+    Track_point point = { (int32_t)( timestamp_us / 100000 ), (int32_t)lround(fix.latitude * 1e5), (int32_t)lround(fix.longitude * 1e5) };
+
+    portENTER_CRITICAL(&track_mux);
+    counters.fixes++;
+    portEXIT_CRITICAL(&track_mux);
+
+    if ( !have_anchor ) {
+        keep(point);
+        return;
+    }
+
+    // Keep the previous fix when the line from the anchor to this one would pass too far from a dropped fix
+    if ( window_count > 0 ) {
+        bool keep_previous = window_count == TRACK_WINDOW || point.time_ds - anchor.time_ds > TRACK_MAX_INTERVAL_S * 10;
+
+        for ( int i = 0; i < window_count && !keep_previous; i++ ) {
+            keep_previous = distance_m(anchor, point, window[i]) > TRACK_MAX_ERROR_M;
+        }
+
+        if ( keep_previous ) {
+            keep(window[window_count - 1]);
+        }
+    }
+
+    window[window_count++] = point;
+}
+
+void track_end() {
+    if ( window_count > 0 ) {
+        keep(window[window_count - 1]);
+    }
+
+    close_segment();
+    have_anchor = false;
+    window_count = 0;
+}
+
+bool track_upload_next(Track_segment *segment) {
+    portENTER_CRITICAL(&track_mux);
+
+    bool found = uploaded != closed;
+    if ( found ) {
+        *segment = queue[uploaded % TRACK_SEGMENT_QUEUE];
+        uploaded++;
+    }
+
+    portEXIT_CRITICAL(&track_mux);
+
+    return found;
+}
+
+static const char base64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static int base64_encode(const uint8_t *data, size_t len, char *out, size_t size) {
+    size_t n = 0;
+
+    for ( size_t i = 0; i < len && n + 4 < size; i += 3 ) {
+        uint32_t triple = data[i] << 16;
+        if ( i + 1 < len ) {
+            triple |= data[i + 1] << 8;
+        }
+        if ( i + 2 < len ) {
+            triple |= data[i + 2];
+        }
+
+        out[n++] = base64_chars[( triple >> 18 ) & 0x3F];
+        out[n++] = base64_chars[( triple >> 12 ) & 0x3F];
+        out[n++] = i + 1 < len ? base64_chars[( triple >> 6 ) & 0x3F] : '=';
+        out[n++] = i + 2 < len ? base64_chars[triple & 0x3F] : '=';
+    }
+
+    out[n] = '\0';
+    return n;
+}
+
+int track_format_json(const Track_segment &segment, char *buf, size_t size) {
+    int n = snprintf(buf, size, "{\"seq\":%u,\"boot\":%u,\"points\":%u,\"data\":\"",
+        (unsigned)segment.header.seq, (unsigned)segment.header.boot, (unsigned)segment.header.points);
+
+    if ( n < (int)size ) {
+        n += base64_encode((const uint8_t *)&segment, sizeof(segment.header) + segment.header.length, buf + n, size - n);
+    }
+
+    if ( n < (int)size ) {
+        n += snprintf(buf + n, size - n, "\"}");
+    }
+
+    return n;
+}
+
+bool track_sd_pending() {
+    return sd_next != closed;
+}
+
+void track_sd_write(fs::FS &fs) {
+    File file;
+    Track_segment segment;
+
+    for (;;) {
+        portENTER_CRITICAL(&track_mux);
+        bool have_segment = sd_next != closed;
+        if ( have_segment ) {
+            segment = queue[sd_next % TRACK_SEGMENT_QUEUE];
+            sd_next++;
+        }
+        portEXIT_CRITICAL(&track_mux);
+
+        if ( !have_segment ) {
+            break;
+        }
+
+        if ( !file ) {
+            file = fs.open(TRACK_PATH, FILE_APPEND);
+        }
+
+        size_t len = sizeof(segment.header) + segment.header.length;
+        bool written = file && file.write((const uint8_t *)&segment, len) == len;
+
+        portENTER_CRITICAL(&track_mux);
+        if ( written ) {
+            counters.sd_written++;
+        }
+        else {
+            counters.sd_dropped++;
+        }
+        portEXIT_CRITICAL(&track_mux);
+    }
+
+    if ( file ) {
+        file.close();
+    }
+}
+
+void track_stats(Track_stats *stats) {
+    portENTER_CRITICAL(&track_mux);
+    *stats = counters;
+    portEXIT_CRITICAL(&track_mux);
+}
+
+int track_format_stats(char *buf, size_t size) {
+    Track_stats stats;
+    track_stats(&stats);
+
+    return snprintf(buf, size, "{\"fixes\":%u,\"points\":%u,\"segments\":%u,\"bytes\":%u,\"sd_written\":%u,\"sd_dropped\":%u}",
+        (unsigned)stats.fixes, (unsigned)stats.points, (unsigned)stats.segments,
+        (unsigned)stats.bytes, (unsigned)stats.sd_written, (unsigned)stats.sd_dropped);
+}
@@ -0,0 +1,131 @@
+#include <Arduino.h>
+
+#include "config.h"
+#include "functions.h"
+#include "wall_clock.h"
+
+#include <esp_timer.h>
+
+static portMUX_TYPE clock_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// epoch = base_epoch_us + elapsed * ( 1 + drift_ppm / 1e6 ), elapsed since base_timer_us
+static int64_t base_timer_us = 0;
+static int64_t base_epoch_us = 0;
+static int64_t last_gnss_sync_us = 0;
+
+static Clock_stats stats = {};
+
+
+static int64_t epoch_at(int64_t timer_us) {
+    int64_t elapsed_us = timer_us - base_timer_us;
+    return base_epoch_us + elapsed_us + (int64_t)( elapsed_us * ( stats.drift_ppm / 1e6 ) );
+}
+
+void clock_sync(int64_t epoch_us, int64_t measured_at_us, Clock_source source) {
+    portENTER_CRITICAL(&clock_mux);
+
+    if ( stats.syncs > 0 ) {
+        stats.last_error_us = epoch_us - epoch_at(measured_at_us);
+
+        // Drift from GNSS syncs only: network time is too coarse
+        int64_t interval_us = measured_at_us - last_gnss_sync_us;
+        if ( source == clock_gnss && stats.source == clock_gnss && interval_us >= CLOCK_DRIFT_MIN_INTERVAL_S * 1000000LL ) {
+            float drift_ppm = stats.drift_ppm + stats.last_error_us * 1e6f / interval_us;
+
+            // Outliers (missed second, modem latency) are ignored
+            if ( drift_ppm > -CLOCK_DRIFT_MAX_PPM && drift_ppm < CLOCK_DRIFT_MAX_PPM ) {
+                exp_smooth(&stats.drift_ppm, drift_ppm, CLOCK_DRIFT_SMOOTHING);
+            }
+        }
+    }
+
+    base_timer_us = measured_at_us;
+    base_epoch_us = epoch_us;
+
+    if ( source == clock_gnss ) {
+        last_gnss_sync_us = measured_at_us;
+    }
+
+    stats.source = source;
+    stats.syncs++;
+    stats.last_sync_us = measured_at_us;
+
+    portEXIT_CRITICAL(&clock_mux);
+}
+
+bool clock_sync_due(Clock_source source) {
+    int64_t now_us = esp_timer_get_time();
+
+    portENTER_CRITICAL(&clock_mux);
+
+    bool due = stats.syncs == 0;
+    if ( source == clock_gnss ) {
+        due = due || stats.source != clock_gnss || now_us - last_gnss_sync_us > CLOCK_GNSS_SYNC_INTERVAL_S * 1000000LL;
+    }
+    else {
+        due = due || now_us - stats.last_sync_us > CLOCK_NETWORK_SYNC_INTERVAL_S * 1000000LL;
+    }
+
+    portEXIT_CRITICAL(&clock_mux);
+
+    return due;
+}
+
+bool clock_valid() {
+    return stats.syncs > 0;
+}
+
+int64_t clock_now_us() {
+    return clock_epoch_us(esp_timer_get_time());
+}
+
+int64_t clock_epoch_us(int64_t timer_us) {
+    portENTER_CRITICAL(&clock_mux);
+    int64_t epoch_us = stats.syncs > 0 ? epoch_at(timer_us) : 0;
+    portEXIT_CRITICAL(&clock_mux);
+
+    return epoch_us;
+}
+
+// Days since 1970-01-01 of a proleptic Gregorian date, and back (http://howardhinnant.github.io/date_algorithms.html)
+static int64_t days_from_civil(int year, int month, int day) {
+    year -= month <= 2;
+    int era = ( year >= 0 ? year : year - 399 ) / 400;
+    int year_of_era = year - era * 400;
+    int day_of_year = ( 153 * ( month + ( month > 2 ? -3 : 9 ) ) + 2 ) / 5 + day - 1;
+    int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097LL + day_of_era - 719468;
+}
+
+int64_t clock_epoch_from_utc(int year, int month, int day, int hours, int minutes, int seconds) {
+    int64_t days = days_from_civil(year, month, day);
+    return ( ( days * 24 + hours ) * 60 + minutes ) * 60000000LL + seconds * 1000000LL;
+}
+
+void clock_date_time(int64_t epoch_us, Date_time *date_time) {
+    int64_t seconds = epoch_us / 1000000;
+    int64_t days = seconds / 86400;
+    int second_of_day = seconds % 86400;
+
+    days += 719468;
+    int era = ( days >= 0 ? days : days - 146096 ) / 146097;
+    int day_of_era = days - era * 146097LL;
+    int year_of_era = ( day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096 ) / 365;
+    int day_of_year = day_of_era - ( 365 * year_of_era + year_of_era / 4 - year_of_era / 100 );
+    int mp = ( 5 * day_of_year + 2 ) / 153;
+    int month = mp < 10 ? mp + 3 : mp - 9;
+    int year = year_of_era + era * 400 + ( month <= 2 );
+
+    date_time->year = year % 100;
+    date_time->month = month;
+    date_time->day = day_of_year - ( 153 * mp + 2 ) / 5 + 1;
+    date_time->hours = second_of_day / 3600;
+    date_time->minutes = second_of_day / 60 % 60;
+    date_time->seconds = second_of_day % 60;
+}
+
+void clock_stats(Clock_stats *out) {
+    portENTER_CRITICAL(&clock_mux);
+    *out = stats;
+    portEXIT_CRITICAL(&clock_mux);
+}
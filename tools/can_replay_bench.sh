@@ -0,0 +1,13 @@
+#!/bin/sh
+# Replay a CAN trace through the native build at 1x, 10x and maximum speed.
+#
+#   pio run -e native
+#   tools/can_replay_bench.sh trace.log [.pio/build/native/program]
+
+TRACE=${1:?usage: $0 trace [program]}
+PROGRAM=${2:-.pio/build/native/program}
+
+for SPEED in 1 10 0; do
+    NATIVE_CAN_TRACE="$TRACE" NATIVE_CAN_REPLAY_SPEED=$SPEED NATIVE_SD_DIR="${TMPDIR:-/tmp}/can_replay_sd" \
+        "$PROGRAM" | sed -n '/^CAN replay/,$p'
+done
@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+"""
+Convert raw CAN captures of the firmware (.ccap files, see include/can_capture.h)
+to candump -l or SLCAN text, e.g. for the native CAN replay or SavvyCAN.
+
+    tools/ccap2candump.py can_0000.ccap > trace.log
+    tools/ccap2candump.py --slcan can_0000.ccap > trace.slcan
+
+Blocks with a bad magic or CRC are skipped (with a warning on stderr), as are
+the bytes up to the next block header.
+"""
+
+import argparse
+import struct
+import sys
+import zlib
+
+MAGIC = 0x50414343  # "CCAP"
+HEADER = struct.Struct("<IHHIIqII")
+RECORD = struct.Struct("<II8s")
+
+
+def read_blocks(data):
+    pos = 0
+    while pos + HEADER.size <= len(data):
+        magic, version, count, seq, crc, base_us, lost, _ = HEADER.unpack_from(data, pos)
+        end = pos + HEADER.size + count * RECORD.size
+
+        if magic != MAGIC or version != 1 or end > len(data):
+            # Resynchronise on the next header
+            next_pos = data.find(struct.pack("<I", MAGIC), pos + 1)
+            print(f"ccap: bad block at offset {pos}", file=sys.stderr)
+            if next_pos < 0:
+                return
+            pos = next_pos
+            continue
+
+        block = bytearray(data[pos:end])
+        struct.pack_into("<I", block, 12, 0)
+        if zlib.crc32(block) != crc:
+            print(f"ccap: CRC error in block {seq} at offset {pos}", file=sys.stderr)
+        else:
+            if lost:
+                print(f"ccap: {lost} frames lost before block {seq}", file=sys.stderr)
+            yield base_us, [RECORD.unpack_from(data, pos + HEADER.size + i * RECORD.size) for i in range(count)]
+
+        pos = end
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("file")
+    parser.add_argument("--slcan", action="store_true", help="SLCAN output with ms timestamps")
+    parser.add_argument("--interface", default="can0")
+    args = parser.parse_args()
+
+    with open(args.file, "rb") as f:
+        data = f.read()
+
+    out = sys.stdout
+    for base_us, records in read_blocks(data):
+        for time_dlc, id_flags, payload in records:
+            t = base_us + (time_dlc & 0x0FFFFFFF)
+            dlc = time_dlc >> 28
+            can_id = id_flags & 0x1FFFFFFF
+            extended = bool(id_flags & (1 << 29))
+            rtr = bool(id_flags & (1 << 30))
+            hex_data = payload[:dlc].hex().upper()
+
+            if args.slcan:
+                cmd = ("R" if rtr else "T") if extended else ("r" if rtr else "t")
+                id_str = f"{can_id:08X}" if extended else f"{can_id:03X}"
+                out.write(f"{cmd}{id_str}{dlc}{'' if rtr else hex_data}{(t // 1000) % 60000:04X}\r")
+            else:
+                id_str = f"{can_id:08X}" if extended else f"{can_id:03X}"
+                frame = f"{id_str}#R" if rtr else f"{id_str}#{hex_data}"
+                out.write(f"({t // 1000000}.{t % 1000000:06d}) {args.interface} {frame}\n")
+
+
+if __name__ == "__main__":
+    main()
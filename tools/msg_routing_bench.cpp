@@ -0,0 +1,255 @@
+/*
+Host microbenchmark of the message routing decision: the comparison chains of the former msg_forwarder_task
+against the subscriber bitmask table of msg_route() (one lookup, then a loop over the set bits).
+Both deliver to the same sinks, a counter per sink stands for the queue copy.
+
+    g++ -std=gnu++11 -O2 tools/msg_routing_bench.cpp -o /tmp/msg_routing_bench && /tmp/msg_routing_bench
+    g++ -std=gnu++11 -Os tools/msg_routing_bench.cpp -o /tmp/msg_routing_bench && /tmp/msg_routing_bench
+
+The message names are those of the comparison chains (before the subscription table).
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+enum Message_name {
+    invalid,
+
+    ac_status,
+    charger_status,
+    car_status,
+    logger_status,
+
+    charger_max_amps,
+
+    network_status,
+    network_latitude,
+    network_longitude,
+
+    gsm_day,
+    gsm_month,
+    gsm_year,
+    gsm_hours,
+    gsm_minutes,
+    gsm_seconds,
+
+    gnss_latitude,
+    gnss_longitude,
+    gnss_altitude,
+    gnss_speed,
+
+    battery_power_kw,
+    battery_energy_kwh,
+    speed_kmh,
+
+    ac_request,
+    charge_request,
+    update_request,
+    doors_request,
+
+    power_save_mode,
+
+    pressure,
+    pcb_temperature,
+    pressure_altitude,
+
+    toggle_slcan,
+
+    message_name_count,
+};
+
+enum Message_sink {
+    sink_display,
+    sink_leafcan,
+    sink_logger,
+    sink_comm_gnss,
+
+    sink_count,
+};
+
+struct Message {
+    Message_name name;
+    int64_t timestamp_us;
+    float value_float;
+};
+
+static volatile uint32_t delivered[sink_count];
+
+static void deliver(int sink, const Message &msg) {
+    delivered[sink] += (uint32_t)msg.timestamp_us | 1;
+}
+
+// Routing of the former msg_forwarder_task
+__attribute__((noinline)) static void route_chains(const Message &received_msg) {
+    // Display
+    if ( received_msg.name == Message_name::speed_kmh
+        || received_msg.name == Message_name::battery_power_kw
+        || received_msg.name == Message_name::battery_energy_kwh
+        || received_msg.name == Message_name::network_status
+        || received_msg.name == Message_name::power_save_mode
+        || received_msg.name == Message_name::logger_status
+        || received_msg.name == Message_name::charger_status
+        ) {
+        deliver(sink_display, received_msg);
+    }
+
+    // Leaf CAN
+    if ( received_msg.name == Message_name::ac_request
+        || received_msg.name == Message_name::charge_request
+        || received_msg.name == Message_name::doors_request
+        || received_msg.name == Message_name::toggle_slcan
+        ) {
+        deliver(sink_leafcan, received_msg);
+    }
+
+    // Logger
+    if ( received_msg.name == Message_name::speed_kmh
+        || received_msg.name == Message_name::gnss_speed
+        || received_msg.name == Message_name::gnss_latitude
+        || received_msg.name == Message_name::gnss_longitude
+        || received_msg.name == Message_name::gnss_altitude
+        || received_msg.name == Message_name::network_latitude
+        || received_msg.name == Message_name::network_longitude
+        || received_msg.name == Message_name::battery_power_kw
+        || received_msg.name == Message_name::battery_energy_kwh
+        || received_msg.name == Message_name::car_status
+        || received_msg.name == Message_name::charger_status
+        || received_msg.name == Message_name::gsm_year
+        || received_msg.name == Message_name::gsm_month
+        || received_msg.name == Message_name::gsm_day
+        || received_msg.name == Message_name::gsm_hours
+        || received_msg.name == Message_name::gsm_minutes
+        || received_msg.name == Message_name::gsm_seconds
+        || received_msg.name == Message_name::pcb_temperature
+        || received_msg.name == Message_name::pressure
+        || received_msg.name == Message_name::pressure_altitude
+        ) {
+        deliver(sink_logger, received_msg);
+    }
+
+    // MQTT
+    if ( received_msg.name == Message_name::battery_power_kw
+        || received_msg.name == Message_name::battery_energy_kwh
+        || received_msg.name == Message_name::car_status
+        || received_msg.name == Message_name::ac_status
+        || received_msg.name == Message_name::charger_status
+        || received_msg.name == Message_name::charger_max_amps
+        || received_msg.name == Message_name::update_request
+        || received_msg.name == Message_name::pressure_altitude
+        || received_msg.name == Message_name::pcb_temperature
+        ) {
+        deliver(sink_comm_gnss, received_msg);
+    }
+}
+
+// Same subscriptions as a table, filled from the chains so that both route identically
+static uint8_t subscribers[Message_name::message_name_count];
+
+__attribute__((noinline)) static void route_table(const Message &msg) {
+    if ( msg.name >= Message_name::message_name_count ) {
+        return;
+    }
+
+    uint8_t mask = subscribers[msg.name];
+
+    while ( mask ) {
+        int sink = __builtin_ctz(mask);
+        mask &= mask - 1;
+
+        deliver(sink, msg);
+    }
+}
+
+static void fill_table() {
+    for ( int name = 0; name < Message_name::message_name_count; name++ ) {
+        Message msg = { (Message_name)name, 0, 0 };
+        uint32_t before[sink_count];
+
+        for ( int sink = 0; sink < sink_count; sink++ ) {
+            before[sink] = delivered[sink];
+        }
+        route_chains(msg);
+        for ( int sink = 0; sink < sink_count; sink++ ) {
+            if ( delivered[sink] != before[sink] ) {
+                subscribers[name] |= 1 << sink;
+            }
+        }
+    }
+}
+
+static int64_t now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Best of a few runs over the stream, in messages/s
+static double bench(void (*route)(const Message &), const Message *stream, int n, int passes) {
+    double best = 0;
+
+    for ( int run = 0; run < 5; run++ ) {
+        int64_t start = now_ns();
+        for ( int pass = 0; pass < passes; pass++ ) {
+            for ( int i = 0; i < n; i++ ) {
+                route(stream[i]);
+            }
+        }
+        double rate = (double)n * passes / ( ( now_ns() - start ) / 1e9 );
+        if ( rate > best ) {
+            best = rate;
+        }
+    }
+
+    return best;
+}
+
+#define STREAM_LENGTH 4096
+#define PASSES 2000
+
+int main() {
+    fill_table();
+
+    static Message can_mix[STREAM_LENGTH];
+    static Message uniform[STREAM_LENGTH];
+
+    // About one second of the car: power and speed at 100Hz, the other values a few times per second or less
+    static const struct { Message_name name; int weight; } mix[] = {
+        { battery_power_kw, 100 }, { speed_kmh, 100 }, { battery_energy_kwh, 2 }, { charger_status, 1 },
+        { ac_status, 1 }, { car_status, 5 }, { gnss_latitude, 1 }, { gnss_longitude, 1 }, { gnss_altitude, 1 },
+        { gnss_speed, 1 }, { pressure, 1 }, { pcb_temperature, 1 }, { pressure_altitude, 1 },
+    };
+    int total_weight = 0;
+    for ( const auto &m : mix ) {
+        total_weight += m.weight;
+    }
+
+    srand(1);
+    for ( int i = 0; i < STREAM_LENGTH; i++ ) {
+        int r = rand() % total_weight;
+        int k = 0;
+        while ( r >= mix[k].weight ) {
+            r -= mix[k++].weight;
+        }
+
+        can_mix[i] = { mix[k].name, i, 0 };
+        uniform[i] = { (Message_name)( rand() % Message_name::message_name_count ), i, 0 };
+    }
+
+    const struct { const char *name; const Message *stream; } streams[] = {
+        { "CAN mix (100Hz power and speed)", can_mix },
+        { "all names, uniform", uniform },
+    };
+
+    for ( const auto &s : streams ) {
+        double before = bench(route_chains, s.stream, STREAM_LENGTH, PASSES);
+        double after = bench(route_table, s.stream, STREAM_LENGTH, PASSES);
+
+        printf("%s\n", s.name);
+        printf("  comparison chains  %7.1f M messages/s (%.2f ns/message)\n", before / 1e6, 1e9 / before);
+        printf("  subscriber table   %7.1f M messages/s (%.2f ns/message), x%.2f\n", after / 1e6, 1e9 / after, after / before);
+    }
+
+    return 0;
+}
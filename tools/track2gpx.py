@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+"""
+Decode GNSS track segments of the firmware (see include/track.h) to GPX or CSV:
+/track.bin from the SD-card, or the payloads received on MQTT (track, or backlog
+records of it), one JSON object per line.
+
+    tools/track2gpx.py track.bin > track.gpx
+    mosquitto_sub -t myCar/track -t myCar/backlog > track.txt
+    tools/track2gpx.py --csv track.txt > track.csv
+
+Times are UTC when the clock of the firmware was set, esp_timer times otherwise.
+"""
+
+import argparse
+import base64
+import datetime
+import json
+import struct
+import sys
+
+MAGIC = 0x4B415254  # "TRAK"
+HEADER = struct.Struct("<IBBHIIq")
+
+
+def read_varint(data, pos):
+    value = shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            return (value >> 1) ^ -(value & 1), pos
+
+
+def read_segments(data):
+    pos = 0
+    while pos + HEADER.size <= len(data):
+        magic, version, points, length, seq, boot, epoch_offset_ms = HEADER.unpack_from(data, pos)
+        end = pos + HEADER.size + length
+
+        if magic != MAGIC or version != 1 or end > len(data):
+            # Resynchronise on the next header
+            next_pos = data.find(struct.pack("<I", MAGIC), pos + 1)
+            print(f"track: bad segment at offset {pos}", file=sys.stderr)
+            if next_pos < 0:
+                return
+            pos = next_pos
+            continue
+
+        values = [0, 0, 0]
+        track = []
+        p = pos + HEADER.size
+        for _ in range(points):
+            for i in range(3):
+                delta, p = read_varint(data, p)
+                values[i] += delta
+            time_ds, lat_e5, lon_e5 = values
+            track.append((time_ds * 100 + epoch_offset_ms if epoch_offset_ms else time_ds * 100,
+                          lat_e5 / 1e5, lon_e5 / 1e5))
+
+        yield seq, boot, bool(epoch_offset_ms), track
+        pos = end
+
+
+def read_mqtt(lines):
+    for line in lines:
+        line = line.strip()
+        if not line.startswith("{"):
+            continue
+        message = json.loads(line)
+        if message.get("topic") == "track":
+            message = message["data"]
+        if "points" in message and "data" in message:
+            yield from read_segments(base64.b64decode(message["data"]))
+
+
+def format_time(time_ms, utc):
+    if not utc:
+        return f"{time_ms / 1000:.1f}"
+    return datetime.datetime.fromtimestamp(time_ms / 1000, datetime.timezone.utc).strftime("%Y-%m-%dT%H:%M:%S.%fZ")[:-5] + "Z"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("file")
+    parser.add_argument("--csv", action="store_true", help="CSV output: time, latitude, longitude, segment, boot")
+    args = parser.parse_args()
+
+    with open(args.file, "rb") as f:
+        data = f.read()
+
+    if data[:4] == struct.pack("<I", MAGIC):
+        segments = list(read_segments(data))
+    else:
+        segments = list(read_mqtt(data.decode(errors="replace").splitlines()))
+
+    out = sys.stdout
+    if args.csv:
+        out.write("time,latitude,longitude,segment,boot\n")
+        for seq, boot, utc, track in segments:
+            for time_ms, lat, lon in track:
+                out.write(f"{format_time(time_ms, utc)},{lat:.5f},{lon:.5f},{seq},{boot}\n")
+        return
+
+    out.write('<?xml version="1.0" encoding="UTF-8"?>\n')
+    out.write('<gpx version="1.1" creator="connected-car" xmlns="http://www.topografix.com/GPX/1/1">\n<trk>\n')
+    for seq, boot, utc, track in segments:
+        out.write(f"<trkseg><!-- segment {seq}, boot {boot} -->\n")
+        for time_ms, lat, lon in track:
+            time_tag = f"<time>{format_time(time_ms, utc)}</time>" if utc else ""
+            out.write(f'<trkpt lat="{lat:.5f}" lon="{lon:.5f}">{time_tag}</trkpt>\n')
+        out.write("</trkseg>\n")
+    out.write("</trk>\n</gpx>\n")
+
+
+if __name__ == "__main__":
+    main()